@@ -23,20 +23,191 @@
 
 =========================================================================*/
 #include "AddArray.h"
+#include "BinaryArrayFile.h"
 #include "CommandLineHelper.h"
+#include "MappedFile.h"
+#include "ScratchStore.h"
+#include "ThreadPool.h"
 #include "vtkPolyData.h"
 #include "vtkPointData.h"
 #include "vtkCellData.h"
-#include "vtkDoubleArray.h"
+#include "vtkDataArray.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace add_array {
+
+// Smallest part of the file that is worth parsing on its own thread
+const vtkIdType MinChunkSize = 1 << 16;
+
+// Problems found when parsing a row
+enum ErrorKind { NO_ERROR, TOO_FEW, TOO_MANY, INVALID };
+
+// The first problem found in a chunk, rows and columns count from zero
+struct ParseError
+{
+  ErrorKind kind;
+  vtkIdType row;
+  int col;
+  std::string value;
+};
+
+inline bool IsBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Find the end of the line that starts at p
+inline const char *FindLineEnd(const char *p, const char *end)
+{
+  const char *eol = (const char *) memchr(p, '\n', end - p);
+  return eol ? eol : end;
+}
+
+// Parse ncol values from the line [p, eol) into out. Returns the column at
+// which a problem was found and sets kind, or ncol if there is none
+int ParseRow(const char *p, const char *eol, int ncol, double *out,
+             ErrorKind &kind, std::string &bad_value)
+{
+  for(int k = 0; k < ncol; k++)
+    {
+    while(p < eol && IsBlank(*p))
+      p++;
+    if(p == eol)
+      {
+      kind = TOO_FEW;
+      return k;
+      }
+
+    // Leading plus signs are accepted, as they are by istream
+    const char *start = p;
+    if(*p == '+' && p + 1 < eol && !IsBlank(p[1]) && p[1] != '-')
+      p++;
+    std::from_chars_result r = std::from_chars(p, eol, out[k]);
+    if(r.ec != std::errc() || (r.ptr < eol && !IsBlank(*r.ptr)))
+      {
+      kind = INVALID;
+      bad_value = std::string(start, std::find_if(start, eol, IsBlank));
+      return k;
+      }
+    p = r.ptr;
+    }
+
+  while(p < eol && IsBlank(*p))
+    p++;
+  kind = p < eol ? TOO_MANY : NO_ERROR;
+  return ncol;
+}
+
+// Count the values on a line
+int CountValues(const char *p, const char *eol)
+{
+  int n = 0;
+  while(p < eol)
+    {
+    while(p < eol && IsBlank(*p))
+      p++;
+    if(p < eol)
+      n++;
+    while(p < eol && !IsBlank(*p))
+      p++;
+    }
+  return n;
+}
+
+// Parse the first n rows of ncol values in the text [begin, end) into out.
+// The text is split into chunks at line breaks, the rows in each chunk are
+// counted to number them, then the chunks are parsed in parallel. Returns
+// the number of rows in the text, and the problem in the earliest row if
+// there is one
+vtkIdType ParseRows(ThreadPool *pool, const char *begin, const char *end,
+                    vtkIdType n, int ncol, double *out, ParseError &first_error)
+{
+  // Split the text into chunks that start at the beginning of a line
+  vtkIdType size = end - begin;
+  vtkIdType n_chunks = std::max((vtkIdType) 1,
+    std::min((vtkIdType) (4 * pool->GetNumberOfThreads()), size / MinChunkSize));
+  std::vector<const char *> split(n_chunks + 1);
+  for(vtkIdType c = 0; c <= n_chunks; c++)
+    {
+    const char *q = begin + size * c / n_chunks;
+    if(c > 0 && q < end)
+      {
+      q = FindLineEnd(q, end);
+      q = q < end ? q + 1 : end;
+      }
+    split[c] = std::max(q, c > 0 ? split[c - 1] : begin);
+    }
+
+  // Find the row at which each chunk starts
+  std::vector<vtkIdType> first_row(n_chunks + 1, 0);
+  pool->ParallelFor(n_chunks, [&](vtkIdType c0, vtkIdType c1)
+    {
+    for(vtkIdType c = c0; c < c1; c++)
+      first_row[c + 1] = std::count(split[c], split[c + 1], '\n');
+    });
+  for(vtkIdType c = 0; c < n_chunks; c++)
+    first_row[c + 1] += first_row[c];
+
+  // A last line without a line break is still a row
+  vtkIdType n_rows = first_row[n_chunks] + (size > 0 && end[-1] != '\n' ? 1 : 0);
+
+  // Parse the chunks, rows after the n-th are ignored
+  std::vector<ParseError> errors(n_chunks);
+  pool->ParallelFor(n_chunks, [&](vtkIdType c0, vtkIdType c1)
+    {
+    for(vtkIdType c = c0; c < c1; c++)
+      {
+      ParseError &err = errors[c];
+      err.kind = NO_ERROR;
+      vtkIdType row = first_row[c];
+      for(const char *q = split[c]; q < split[c + 1] && row < n && err.kind == NO_ERROR; row++)
+        {
+        const char *eol = FindLineEnd(q, split[c + 1]);
+        err.col = ParseRow(q, eol, ncol, out + row * ncol, err.kind, err.value);
+        err.row = row;
+        q = eol + 1;
+        }
+      }
+    });
+
+  // Keep the problem in the earliest row
+  first_error.kind = NO_ERROR;
+  for(vtkIdType c = 0; c < n_chunks && first_error.kind == NO_ERROR; c++)
+    first_error = errors[c];
+
+  return n_rows;
+}
+
+} // namespace
+
+using namespace add_array;
 
 bool
 AddArray::Parse(CommandLineHelper &cl)
 {
-  if(!cl.try_command("-aa", "-add-array"))
-    return false;
+  if(cl.try_command("-aa", "-add-array"))
+    {
+    string array = cl.read_string();
+    string fin = cl.read_existing_filename();
+    this->Schedule([=]() { this->Run(array, fin); });
+    return true;
+    }
+
+  if(cl.try_command("-aar", "-add-array-raw"))
+    {
+    string array = cl.read_string();
+    string fin = cl.read_existing_filename();
+    string dtype = cl.read_string();
+    int nc = (int) cl.read_integer();
+    if(BinaryArrayFile::GetDataType(dtype) < 0)
+      this->ThrowException("Unknown data type %s for file %s\n", dtype.c_str(), fin.c_str());
+    this->Schedule([=]() { this->RunRaw(array, fin, dtype, nc); });
+    return true;
+    }
 
-  this->Run(cl.read_string(), cl.read_existing_filename());
-  return true;
+  return false;
 }
 
 void
@@ -45,63 +216,102 @@ AddArray::Run(const string &array, const string &fin)
   // Get mesh from stack
   PolyDataPointer p = this->TopPolyData();
 
-  // Get the number of points or cells to read
-  int n = this->GetDataArraySize(p);
-  int ncol = 0;
-
-  // Open the file
-  std::ifstream is(fin.c_str());
-
-  // Figure out the number of rows
-  string line;
-  if(!getline(is, line))
-    this->ThrowException("Unable to read one line from %s\n", fin.c_str());
-
-  double val = 0.0;
-  std::vector<double> row;
-  std::istringstream iss(line);
-  while(iss >> val)
-    row.push_back(val);
+  // Binary NumPy arrays are read as they are
+  if(fin.length() >= 4 && fin.rfind(".npy") == fin.length() - 4)
+    {
+    vtkSmartPointer<vtkDataArray> da = BinaryArrayFile::ReadNumpy(fin, this->GetScratchStore());
+    this->AddBinaryArray(array, da, fin);
+    return;
+    }
 
-  // Figure out number of columsn
-  ncol = row.size();
+  // Get the number of points or cells to read
+  vtkIdType n = this->GetDataArraySize(p);
 
+  // Map the file, each row of text is one tuple
+  MappedFile file;
+  file.Open(fin);
+  const char *begin = file.GetData(), *end = begin + file.GetSize();
 
+  // The number of columns is set by the first row
+  int ncol = CountValues(begin, FindLineEnd(begin, end));
   if(ncol == 0)
     this->ThrowException("No columns in file %s\n", fin.c_str());
 
-  // Allocate the array
-  vtkSmartPointer<vtkDoubleArray> da = vtkDoubleArray::New();
-  da->SetNumberOfComponents(ncol);
-  da->SetNumberOfTuples(n);
-
-  // Fill the first entry
-  for(int i = 0; i < ncol; i++)
-    da->SetComponent(0, i, row[i]);
+  // Allocate the array, in a scratch file if one is set
+  ScratchStore *store = this->GetScratchStore();
+  vtkSmartPointer<vtkDataArray> da = store->NewArray(VTK_DOUBLE, ncol, n);
+  double *out = static_cast<double *>(da->GetVoidPointer(0));
 
-  // Read the rest of the file
-  for(int j = 1; j < n; j++)
+  // Parse the text in windows of about half the memory budget, each of which
+  // is parsed in parallel, and release the tuples of each window when done
+  size_t budget = store->GetMemoryBudget();
+  size_t window = budget ? std::max(budget / 2, (size_t) MinChunkSize) : file.GetSize();
+  vtkIdType n_rows = 0;
+  ParseError err;
+  err.kind = NO_ERROR;
+  for(const char *q = begin; q < end && n_rows < n && err.kind == NO_ERROR; )
     {
-    if(getline(is, line))
+    const char *q_end = end;
+    if((size_t) (end - q) > window)
       {
-      for(int i = 0; i < ncol; i++)
-        {
-        std::istringstream iss(line);
-        double val;
-        if(iss >> val)
-          {
-          da->SetComponent(j, i, val);
-          }
-        else
-          this->ThrowException("Too few components in row %d of file %s. Expected %d, read %d",
-            j, fin.c_str(), ncol, i);
-        }
+      q_end = FindLineEnd(q + window, end);
+      q_end = q_end < end ? q_end + 1 : end;
       }
-    else this->ThrowException("File %s ended on line %d, but %d array tuples were expected",
-      fin.c_str(), j, n);
+
+    vtkIdType rows = ParseRows(this->GetThreadPool(), q, q_end, n - n_rows, ncol, out + n_rows * ncol, err);
+    if(err.kind != NO_ERROR)
+      err.row += n_rows;
+    ScratchStore::Release(da, n_rows, std::min(n, n_rows + rows));
+    n_rows += rows;
+    q = q_end;
     }
 
+  if(err.kind == TOO_FEW)
+    this->ThrowException("Too few components in row %ld of file %s. Expected %d, read %d",
+      (long) err.row + 1, fin.c_str(), ncol, err.col);
+  else if(err.kind == TOO_MANY)
+    this->ThrowException("Too many components in row %ld of file %s. Expected %d",
+      (long) err.row + 1, fin.c_str(), ncol);
+  else if(err.kind == INVALID)
+    this->ThrowException("Invalid value '%s' in row %ld, column %d of file %s",
+      err.value.c_str(), (long) err.row + 1, err.col + 1, fin.c_str());
+
+  if(n_rows < n)
+    this->ThrowException("File %s ended on line %ld, but %ld array tuples were expected",
+      fin.c_str(), (long) n_rows, (long) n);
+
   // Add the array
   da->SetName(array.c_str());
   this->AddDataArray(p, da);
 }
+
+void
+AddArray::RunRaw(const string &array, const string &fin, const string &dtype, int nc)
+{
+  int type = BinaryArrayFile::GetDataType(dtype);
+  if(type < 0)
+    this->ThrowException("Unknown data type %s for file %s\n", dtype.c_str(), fin.c_str());
+  if(nc < 1)
+    this->ThrowException("Invalid number of components %d for file %s\n", nc, fin.c_str());
+
+  vtkSmartPointer<vtkDataArray> da = BinaryArrayFile::ReadRaw(fin, type, nc, this->GetScratchStore());
+  this->AddBinaryArray(array, da, fin);
+}
+
+void
+AddArray::AddBinaryArray(const string &array, vtkDataArray *da, const string &fin)
+{
+  PolyDataPointer p = this->TopPolyData();
+
+  // Unlike text files, binary files must hold exactly one tuple per element
+  vtkIdType n = this->GetDataArraySize(p);
+  if(da->GetNumberOfTuples() != n)
+    this->ThrowException("File %s has %ld array tuples, but %ld were expected\n",
+      fin.c_str(), (long) da->GetNumberOfTuples(), (long) n);
+
+  this->Info("Read %ld x %d array of type %s from %s\n", (long) n,
+    da->GetNumberOfComponents(), da->GetDataTypeAsString(), fin.c_str());
+
+  da->SetName(array.c_str());
+  this->AddDataArray(p, da);
+}
@@ -41,8 +41,22 @@ public:
   /** The command-line parsing functionality */
   bool Parse(CommandLineHelper &cl);
 
-  /** The main entrypoint for the API */
-  void Run(const string &array, const string &fout);
+  /**
+   * The main entrypoint for the API. The file is a .npy file, or a text
+   * file with one row of values per tuple
+   */
+  void Run(const string &array, const string &fin);
+
+  /**
+   * Add an array from a raw binary file of nc-component tuples, with
+   * values of a NumPy dtype such as float32
+   */
+  void RunRaw(const string &array, const string &fin, const string &dtype, int nc);
+
+protected:
+
+  /** Add an array read from a binary file after checking its size */
+  void AddBinaryArray(const string &array, vtkDataArray *da, const string &fin);
 };
 
 #endif
@@ -24,21 +24,169 @@
 =========================================================================*/
 #include "DiffuseArray.h"
 #include "CommandLineHelper.h"
+#include "GraphLaplacian.h"
+#include "MeshAdjacency.h"
+#include "MeshTopology.h"
+#include "ScratchStore.h"
+#include "SpectralBasis.h"
 #include "vtkPolyData.h"
 #include "vtkPointData.h"
 #include "vtkCellData.h"
-#include "vtkCell.h"
 #include "vtkDoubleArray.h"
+#include "vtkFloatArray.h"
+#include "vtksys/Glob.hxx"
+#include "vtksys/RegularExpression.hxx"
 #include <algorithm>
-#include <set>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 
 namespace diffuse_array {
 
-class Edge : public std::pair<vtkIdType, vtkIdType>
+// Number of RKL super steps an interval between output times is split into
+// by default. A super step damps the modes it does not resolve by only
+// about half, however fast they decay in the exact solution, so it is the
+// number of super steps rather than their length that limits the error
+const int DefaultSuperSteps = 25;
+
+// Limit on the conjugate gradient iterations of an implicit step
+const int MaxImplicitIterations = 1000;
+
+// Check if a command line argument is a number or a list of numbers in the
+// format 1x2x5 accepted by CommandLineHelper::read_double_vector. Only
+// decimal numbers count, so that arrays named nan or inf are not taken for
+// times, and 0x10 is a list rather than a hexadecimal number
+bool IsNumberList(const char *arg)
+{
+  string s(arg);
+  if(s.find_first_not_of("0123456789+-.eEx") != string::npos)
+    return false;
+
+  for(size_t begin = 0; ; )
+    {
+    size_t end = std::min(s.find('x', begin), s.size());
+    string number = s.substr(begin, end - begin);
+    char *pend;
+    std::strtod(number.c_str(), &pend);
+    if(number.empty() || *pend != 0)
+      return false;
+    if(end == s.size())
+      return true;
+    begin = end + 1;
+    }
+}
+
+// Find the arrays matching a list of names or wildcard patterns
+std::vector<vtkDataArray *> FindArrays(vtkFieldData *fd, const std::vector<string> &patterns)
+{
+  std::vector<vtkDataArray *> arrays;
+  for(size_t p = 0; p < patterns.size(); p++)
+    {
+    vtksys::RegularExpression re(vtksys::Glob::PatternToRegex(patterns[p], true, true));
+    int n_found = 0;
+    for(int i = 0; i < fd->GetNumberOfArrays(); i++)
+      {
+      vtkDataArray *arr = fd->GetArray(i);
+      if(arr && arr->GetName() && re.find(arr->GetName()))
+        {
+        if(std::find(arrays.begin(), arrays.end(), arr) == arrays.end())
+          arrays.push_back(arr);
+        n_found++;
+        }
+      }
+
+    if(n_found == 0)
+      throw MeshException("Missing array %s in mesh", patterns[p].c_str());
+    }
+
+  return arrays;
+}
+
+// Create arrays of the same type as the source arrays to hold the result of
+// diffusion for each of the times, named like thickness_t5
+std::vector<std::vector<vtkDataArray *> >
+CreateSnapshotArrays(vtkFieldData *fd, const std::vector<vtkDataArray *> &arrays,
+                     const std::vector<double> &times, const ScratchStore *store)
+{
+  std::vector<std::vector<vtkDataArray *> > snapshots(times.size());
+  for(size_t k = 0; k < times.size(); k++)
+    {
+    for(size_t a = 0; a < arrays.size(); a++)
+      {
+      char name[1024];
+      snprintf(name, sizeof(name), "%s_t%g", arrays[a]->GetName(), times[k]);
+
+      vtkSmartPointer<vtkDataArray> arr = store->NewArray(
+        arrays[a]->GetDataType(), arrays[a]->GetNumberOfComponents(),
+        arrays[a]->GetNumberOfTuples());
+      arr->SetName(name);
+      fd->AddArray(arr);
+      snapshots[k].push_back(arr);
+      }
+    }
+
+  return snapshots;
+}
+
+// Copy the arrays into consecutive columns of an interleaved buffer, or back
+template <class TReal>
+void PackArrays(const std::vector<vtkDataArray *> &arrays, TReal *buffer, bool unpack)
 {
-public:
-  Edge(vtkIdType a, vtkIdType b) : std::pair<vtkIdType,vtkIdType>(std::min(a,b), std::max(a,b)) {}
-};
+  int nc = 0;
+  for(size_t a = 0; a < arrays.size(); a++)
+    nc += arrays[a]->GetNumberOfComponents();
+
+  int col = 0;
+  for(size_t a = 0; a < arrays.size(); a++)
+    {
+    vtkDataArray *arr = arrays[a];
+    vtkIdType n = arr->GetNumberOfTuples();
+    int nca = arr->GetNumberOfComponents();
+
+    // Arrays stored as double or float are accessed directly
+    vtkDoubleArray *arr_double = vtkDoubleArray::SafeDownCast(arr);
+    vtkFloatArray *arr_float = vtkFloatArray::SafeDownCast(arr);
+    double *pd = arr_double ? arr_double->GetPointer(0) : NULL;
+    float *pf = arr_float ? arr_float->GetPointer(0) : NULL;
+    for(vtkIdType i = 0; i < n; i++)
+      for(int j = 0; j < nca; j++)
+        {
+        TReal &b = buffer[i * nc + col + j];
+        vtkIdType ij = i * nca + j;
+        if(unpack)
+          {
+          if(pd) pd[ij] = b;
+          else if(pf) pf[ij] = (float) b;
+          else arr->SetComponent(i, j, b);
+          }
+        else
+          {
+          if(pd) b = (TReal) pd[ij];
+          else if(pf) b = pf[ij];
+          else b = (TReal) arr->GetComponent(i, j);
+          }
+        }
+
+    if(unpack)
+      arr->Modified();
+    col += nca;
+    }
+}
+
+// The VTK array class that stores a given type
+template <class TReal> struct RealArray { typedef vtkDoubleArray Type; };
+template <> struct RealArray<float> { typedef vtkFloatArray Type; };
+
+// Number of arrays of the size of the data that a scheme works with
+int GetWorkingCopies(DiffuseArray::Scheme scheme)
+{
+  switch(scheme)
+    {
+    case DiffuseArray::RKL: return 6;
+    case DiffuseArray::IMPLICIT: return 7;
+    default: return 2;
+    }
+}
 
 } // namespace
 
@@ -46,206 +194,430 @@ using namespace diffuse_array;
 
 DiffuseArray::DiffuseArray(Converter *c) : CommandAdapter(c)
 {
-  m_DeltaT = 0.01;
+  m_Scheme = EXPLICIT;
+  m_Precision = DOUBLE;
+  m_Weights = UNIFORM;
+  m_DeltaT = 0.0;
+  m_Modes = 100;
 }
 
 bool
 DiffuseArray::Parse(CommandLineHelper &cl)
 {
+  // Options that apply to subsequent diffusion commands
+  if(cl.try_command("-diffuse-scheme"))
+    {
+    string scheme = cl.read_string();
+    Scheme value;
+    if(scheme == "explicit")
+      value = EXPLICIT;
+    else if(scheme == "implicit")
+      value = IMPLICIT;
+    else if(scheme == "spectral")
+      value = SPECTRAL;
+    else if(scheme == "rkl")
+      value = RKL;
+    else
+      this->ThrowException("Unknown diffusion scheme %s", scheme.c_str());
+    this->Schedule([=]() { this->SetScheme(value); });
+    return true;
+    }
+
+  if(cl.try_command("-diffuse-precision"))
+    {
+    string prec = cl.read_string();
+    Precision value;
+    if(prec == "double")
+      value = DOUBLE;
+    else if(prec == "float")
+      value = FLOAT;
+    else if(prec == "mixed")
+      value = MIXED;
+    else
+      this->ThrowException("Unknown diffusion precision %s", prec.c_str());
+    this->Schedule([=]() { this->SetPrecision(value); });
+    return true;
+    }
+
+  if(cl.try_command("-diffuse-weights"))
+    {
+    string weights = cl.read_string();
+    Weights value;
+    if(weights == "uniform")
+      value = UNIFORM;
+    else if(weights == "cotan")
+      value = COTANGENT;
+    else
+      this->ThrowException("Unknown diffusion weights %s", weights.c_str());
+    this->Schedule([=]() { this->SetWeights(value); });
+    return true;
+    }
+
+  if(cl.try_command("-diffuse-dt"))
+    {
+    double dt = cl.read_double();
+    if(dt < 0.0)
+      this->ThrowException("Diffusion time step must not be negative, got %f", dt);
+    this->Schedule([=]() { this->SetDeltaT(dt); });
+    return true;
+    }
+
+  if(cl.try_command("-diffuse-modes"))
+    {
+    long k = cl.read_integer();
+    if(k < 1)
+      this->ThrowException("Number of eigenmodes must be positive, got %ld", k);
+    this->Schedule([=]() { this->SetNumberOfModes((int) k); });
+    return true;
+    }
+
+  if(cl.try_command("-diffuse-basis"))
+    {
+    string fn = cl.read_output_filename();
+    this->Schedule([=]() { this->SetBasisFile(fn); });
+    return true;
+    }
+
   if(!cl.try_command("-diffuse") && !cl.try_command("-diffuse-array"))
     return false;
 
+  // One or more array names or wildcard patterns, followed by the time or
+  // a list of times separated by 'x'
+  std::vector<string> arrays;
+  arrays.push_back(cl.read_string());
+  while(!IsNumberList(cl.peek_arg()))
+    arrays.push_back(cl.read_string());
+
   // Run command
-  this->Run(cl.read_string(), cl.read_double());
+  std::vector<double> times = cl.read_double_vector();
+  this->Schedule([=]() { this->Run(arrays, times); });
 
   return true;
 }
 
 void
-DiffuseArray::Run(const string &array, double time)
+DiffuseArray::Run(const std::vector<string> &arrays, const std::vector<double> &times)
 {
+  // Integrate forward through the times in order
+  std::vector<double> sorted = times;
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  if(sorted.empty() || sorted[0] < 0.0)
+    this->ThrowException("Diffusion times must not be negative");
+
   if(this->c->GetCellMode())
-    this->RunCellArray(array, time);
+    this->RunCellArray(arrays, sorted);
   else
-    this->RunPointArray(array, time);
+    this->RunPointArray(arrays, sorted);
+}
+
+void
+DiffuseArray::Run(const std::vector<string> &arrays, double time)
+{
+  this->Run(arrays, std::vector<double>(1, time));
+}
+
+void
+DiffuseArray::Run(const string &array, double time)
+{
+  this->Run(std::vector<string>(1, array), time);
 }
 
 void
-DiffuseArray::RunPointArray(const string &array, double time)
+DiffuseArray::RunPointArray(const std::vector<string> &arrays, const std::vector<double> &times)
 {
   // Diffusion simulates heat equation, dF/dt = -Laplacian(F), for t = time
-  // We use the most basic approximation of the laplacian L(F) = [Sum_{j\in N(i)} F(j) - F(i)] / |N(i)|
+  // By default we use the most basic approximation of the laplacian
+  // L(F) = [Sum_{j\in N(i)} F(j) - F(i)] / |N(i)|, or else the cotangent
+  // Laplacian L(F) = [Sum_{j\in N(i)} w_ij (F(j) - F(i))] / m_i
   PolyDataPointer mesh = this->TopPolyData();
 
-  // Create a set of all edges in the mesh
-  typedef std::set<Edge> EdgeSet;
-  EdgeSet edges;
+  // Report
+  Info("Performing diffusion on point data (t = %f)\n", times.back());
+
+  // Get the vertex adjacency graph in CSR form
+  const MeshAdjacency &adj = this->TopTopology()->GetVertexAdjacency();
+  this->Debug("Vertex adjacency has %ld edges (%.1f MB)\n",
+    (long) adj.GetNumberOfEdges(), adj.GetMemorySize() / (1024.0 * 1024.0));
+
+  // The cotangent weights are computed once for the geometry of the mesh
+  const CotangentWeights *weights = NULL;
+  if(m_Weights == COTANGENT)
+    {
+    weights = &this->TopTopology()->GetCotangentWeights();
+    this->Debug("Cotangent weights use %.1f MB\n", weights->GetMemorySize() / (1024.0 * 1024.0));
+    }
+
+  // Get the arrays and diffuse them together
+  this->Diffuse(adj, weights, mesh->GetPointData(), FindArrays(mesh->GetPointData(), arrays), times);
+}
+
+
+void
+DiffuseArray::RunCellArray(const std::vector<string> &arrays, const std::vector<double> &times)
+{
+  // Get the mesh
+  PolyDataPointer mesh = this->TopPolyData();
+  if(m_Weights == COTANGENT)
+    this->ThrowException("Cotangent weights are only defined for point data");
 
   // Report
-  Info("Performing diffusion on point data (t = %f, delta_t = %f)\n", time, m_DeltaT);
+  this->Debug("Performing diffusion on cell data (t = %f)\n", times.back());
+
+  // Diffusion, but between cells. This is really pretty ad hoc now. Cells
+  // are adjacent if they share an edge (triangles) or a face (tetras)
+  const MeshAdjacency &adj = this->TopTopology()->GetCellAdjacency();
+  this->Debug("There are %ld pairs of adjacent cells\n", (long) adj.GetNumberOfEdges());
+
+  // Get the arrays and diffuse them together
+  this->Diffuse(adj, NULL, mesh->GetCellData(), FindArrays(mesh->GetCellData(), arrays), times);
+}
+
+
+double
+DiffuseArray::GetTimeStep(const GraphLaplacian &lap) const
+{
+  // The defaults scale with the stable explicit step, which is 1 for the
+  // umbrella operator, and depends on the edge lengths for the cotangent
+  // operator. The explicit scheme uses a small fraction of it for accuracy.
+  // The implicit scheme is unconditionally stable and can take steps on the
+  // order of the time it takes to diffuse between neighboring nodes
+  if(m_DeltaT > 0.0)
+    return m_DeltaT;
+  double dt_stable = lap.GetStableTimeStep();
+  if(m_Scheme == IMPLICIT)
+    return dt_stable;
+  if(m_Scheme == RKL)
+    return 2.0 * dt_stable;  // shortest default super step, see Advance
+  return 0.01 * dt_stable;
+}
+
+
+const SpectralBasis &
+DiffuseArray::GetSpectralBasis(const MeshAdjacency &adj, GraphLaplacian &lap)
+{
+  // Reuse the basis from a previous command on the same graph
+  int k = (int) std::min((vtkIdType) m_Modes, adj.GetNumberOfNodes());
+  if(m_Basis && m_Basis->IsCompatible(lap)
+     && m_Basis->GetNumberOfModes() == k)
+    return *m_Basis;
 
-  // Get all edges into the edge set
-  for(int i = 0; i < mesh->GetNumberOfCells(); i++)
+  m_Basis = std::make_shared<SpectralBasis>();
+
+  if(m_BasisFile.size() && vtksys::SystemTools::FileExists(m_BasisFile.c_str()))
     {
-    vtkCell *cell = mesh->GetCell(i);
-    vtkIdType *p = cell->GetPointIds()->GetPointer(0);
-    if(cell->GetCellType() == VTK_TRIANGLE)
-      {
-      edges.insert(Edge(p[0], p[1]));
-      edges.insert(Edge(p[1], p[2]));
-      edges.insert(Edge(p[0], p[2]));
-      }
-    else if(cell->GetCellType() == VTK_TETRA)
+    m_Basis->Load(m_BasisFile);
+    if(!m_Basis->IsCompatible(lap))
       {
-      edges.insert(Edge(p[0], p[1]));
-      edges.insert(Edge(p[0], p[2]));
-      edges.insert(Edge(p[0], p[3]));
-      edges.insert(Edge(p[1], p[2]));
-      edges.insert(Edge(p[1], p[3]));
-      edges.insert(Edge(p[2], p[3]));
+      m_Basis.reset();
+      this->ThrowException("Spectral basis in %s does not match the mesh", m_BasisFile.c_str());
       }
-    else this->ThrowException("Wrong cell type for diffusion, must be triangle or tetra");
+    this->Info("Read spectral basis with %d modes from %s\n",
+      m_Basis->GetNumberOfModes(), m_BasisFile.c_str());
     }
-
-  // Count the number of neighbors of each vertex
-  std::vector<int> nbr(mesh->GetNumberOfPoints(), 0);
-  for(EdgeSet::iterator it = edges.begin(); it!=edges.end(); ++it)
+  else
     {
-    nbr[it->first]++; 
-    nbr[it->second]++;
+    m_Basis->Compute(adj, lap, this->GetThreadPool(), k);
+    this->Info("Computed spectral basis with %d modes in %d Lanczos iterations, "
+      "largest eigenvalue %f\n", k, m_Basis->GetNumberOfIterations(),
+      m_Basis->GetEigenvalue(k - 1));
+    if(m_BasisFile.size())
+      m_Basis->Save(m_BasisFile);
     }
 
-  // Create an array for the updates
-  vtkDataArray *f = mesh->GetPointData()->GetArray(array.c_str());
-  vtkDoubleArray *f_upd = vtkDoubleArray::New();
-  f_upd->SetNumberOfComponents(f->GetNumberOfComponents());
-  f_upd->SetNumberOfTuples(f->GetNumberOfTuples());
+  return *m_Basis;
+}
 
-  // Copy f to f_upd
-  for(int i = 0; i < f->GetNumberOfTuples(); i++)
-    for(int j = 0; j < f->GetNumberOfComponents(); j++)
-      f_upd->SetComponent(i, j, f->GetComponent(i, j));
 
-  // Iterate
-  unsigned int jt = 0;
-  for(double t = 0; t < time - m_DeltaT/2; t+=m_DeltaT)
+void
+DiffuseArray::Diffuse(const MeshAdjacency &adj, const CotangentWeights *weights, vtkFieldData *fd,
+                      const std::vector<vtkDataArray *> &arrays,
+                      const std::vector<double> &times)
+{
+  // The arrays are diffused as the columns of a single interleaved buffer,
+  // so each visit to a neighbor updates all of them
+  vtkIdType n = adj.GetNumberOfNodes();
+  for(size_t a = 0; a < arrays.size(); a++)
     {
-    // Update f_upd
-    for(EdgeSet::iterator it = edges.begin(); it!=edges.end(); ++it)
-      {
-      double wa = m_DeltaT / nbr[it->first];
-      double wb = m_DeltaT / nbr[it->second];
-      int ia = it->first;
-      int ib = it->second;
+    if(arrays[a]->GetNumberOfTuples() != n)
+      this->ThrowException("Array %s has %ld tuples, expected %ld",
+        arrays[a]->GetName(), (long) arrays[a]->GetNumberOfTuples(), (long) n);
+    this->Debug("  diffusing array %s\n", arrays[a]->GetName());
+    }
 
-      for(int j = 0; j < f->GetNumberOfComponents(); j++)
-        {
-        f_upd->SetComponent(ia, j, 
-          f_upd->GetComponent(ia, j) + wa * (f->GetComponent(ib,j) - f->GetComponent(ia, j)));
-        f_upd->SetComponent(ib, j, 
-          f_upd->GetComponent(ib, j) + wb * (f->GetComponent(ia,j) - f->GetComponent(ib, j)));
-        }
-      }
+  // With a single time the arrays are updated in place, otherwise a new
+  // array is created for each array and time and the sources are unchanged
+  ScratchStore *store = this->GetScratchStore();
+  std::vector<std::vector<vtkDataArray *> > outputs;
+  if(times.size() == 1)
+    outputs.push_back(arrays);
+  else
+    outputs = CreateSnapshotArrays(fd, arrays, times, store);
+
+  // Single precision is only used by the explicit scheme, the solvers of
+  // the other schemes need double precision
+  bool single = m_Precision != DOUBLE && m_Scheme == EXPLICIT;
 
-    // Copy f_upd to f
-    for(int i = 0; i < f->GetNumberOfTuples(); i++)
-      for(int j = 0; j < f->GetNumberOfComponents(); j++)
-        f->SetComponent(i, j, f_upd->GetComponent(i, j));
+  // The arrays are diffused in groups whose working data fits the memory
+  // budget. With no budget, or enough of it, there is a single group
+  size_t budget = store->GetMemoryBudget();
+  size_t comp_size = n * (single ? sizeof(float) : sizeof(double)) * GetWorkingCopies(m_Scheme);
+  for(size_t a0 = 0; a0 < arrays.size(); )
+    {
+    size_t a1 = a0;
+    int nc_group = arrays[a1++]->GetNumberOfComponents();
+    while(a1 < arrays.size() &&
+          (budget == 0 || (nc_group + arrays[a1]->GetNumberOfComponents()) * comp_size <= budget))
+      nc_group += arrays[a1++]->GetNumberOfComponents();
+
+    std::vector<vtkDataArray *> group(arrays.begin() + a0, arrays.begin() + a1);
+    std::vector<std::vector<vtkDataArray *> > group_outputs;
+    for(size_t k = 0; k < outputs.size(); k++)
+      group_outputs.push_back(std::vector<vtkDataArray *>(
+        outputs[k].begin() + a0, outputs[k].begin() + a1));
+    if(group.size() < arrays.size())
+      this->Debug("  diffusing arrays %d to %d of %d\n", (int) a0 + 1, (int) a1, (int) arrays.size());
+
+    if(single)
+      this->Integrate<float>(adj, weights, group, group_outputs, times, nc_group);
+    else
+      this->Integrate<double>(adj, weights, group, group_outputs, times, nc_group);
+
+    // Arrays in scratch files are done with until they are written
+    for(size_t k = 0; k < group_outputs.size(); k++)
+      for(size_t a = 0; a < group_outputs[k].size(); a++)
+        ScratchStore::Release(group_outputs[k][a]);
+    for(size_t a = 0; a < group.size(); a++)
+      ScratchStore::Release(group[a]);
+
+    a0 = a1;
     }
 }
 
 
+template <class TReal>
 void
-DiffuseArray::RunCellArray(const string &array, double time)
+DiffuseArray::Integrate(const MeshAdjacency &adj, const CotangentWeights *weights,
+                        const std::vector<vtkDataArray *> &arrays,
+                        const std::vector<std::vector<vtkDataArray *> > &outputs,
+                        const std::vector<double> &times, int nc)
 {
-  // Get the mesh
-  PolyDataPointer mesh = this->TopPolyData();
-
-  // Diffusion, but between cells. This is really pretty ad hoc now
-  mesh->BuildLinks();
+  typedef typename RealArray<TReal>::Type ArrayType;
+  vtkIdType n = adj.GetNumberOfNodes();
+
+  // A single array stored in the working precision is diffused directly
+  // in its own storage, otherwise the arrays are packed into a buffer
+  ArrayType *f_native = (arrays.size() == 1 && times.size() == 1)
+    ? ArrayType::SafeDownCast(arrays[0]) : NULL;
+  std::vector<TReal> f_copy, f_scratch(n * nc);
+  if(!f_native)
+    {
+    f_copy.resize(n * nc);
+    PackArrays(arrays, f_copy.data(), false);
+    }
 
-  // Create a set of all edges in the mesh. These are pairs of adjacent cells that
-  // share an edge
-  typedef std::set<Edge> EdgeSet;
-  EdgeSet edges;
+  TReal *f_data = f_native ? f_native->GetPointer(0) : f_copy.data();
+  TReal *f_cur = f_data, *f_upd = f_scratch.data();
 
-  // Report
-  this->Debug("Performing diffusion on cell data (t = %f, delta_t = %f)\n", time, m_DeltaT);
+  GraphLaplacian lap(adj, this->GetThreadPool(), weights);
+  double dt = this->GetTimeStep(lap), dt_stable = lap.GetStableTimeStep();
+  this->Debug("  time step %f, stable explicit step %f\n", dt, dt_stable);
+  if(m_Scheme == EXPLICIT && dt > dt_stable)
+    this->Info("Warning: time step %f exceeds the stable step %f of the explicit scheme\n",
+      dt, dt_stable);
 
-  // Get all edges into the edge set
-  for(int i = 0; i < mesh->GetNumberOfCells(); i++)
+  // Integrate once, saving the result as we reach each of the times
+  double t_now = 0.0;
+  for(size_t k = 0; k < times.size(); k++)
     {
-    vtkCell *cell = mesh->GetCell(i);
-    if(cell->GetCellType() == VTK_TETRA)
+    this->Advance(adj, lap, nc, f_cur, f_upd, t_now, times[k]);
+
+    // Write the result for this time
+    if(outputs[k] == arrays && f_native)
       {
-      for(int j = 0; j < cell->GetNumberOfFaces(); j++)
-        {
-        vtkSmartPointer<vtkIdList> nbr = vtkIdList::New();
-        vtkCell *face = cell->GetFace(j);
-        mesh->GetCellNeighbors(i, face->GetPointIds(), nbr);
-        for(int k = 0; k < nbr->GetNumberOfIds(); k++)
-          edges.insert(Edge(i, nbr->GetId(k)));
-        }
+      if(f_cur != f_data)
+        std::copy(f_cur, f_cur + n * nc, f_data);
+      f_native->Modified();
       }
-    else if(cell->GetCellType() == VTK_TRIANGLE)
+    else
       {
-      for(int j = 0; j < cell->GetNumberOfEdges(); j++)
-        {
-        vtkSmartPointer<vtkIdList> nbr = vtkIdList::New();
-        vtkCell *edge = cell->GetEdge(j);
-        mesh->GetCellNeighbors(i, edge->GetPointIds(), nbr);
-        for(int k = 0; k < nbr->GetNumberOfIds(); k++)
-          edges.insert(Edge(i, nbr->GetId(k)));
-        }
+      PackArrays(outputs[k], f_cur, true);
       }
-    else throw MeshException("Wrong cell type in CellDataDiffusion");
     }
+}
 
-  this->Debug("There are %d pairs of adjacent cells\n", (int) edges.size());
 
-  // Count the number of neighbors of each cell
-  std::vector<int> nbr(mesh->GetNumberOfCells(), 0);
-  for(EdgeSet::iterator it = edges.begin(); it!=edges.end(); ++it)
+void
+DiffuseArray::Advance(const MeshAdjacency &, GraphLaplacian &lap, int nc,
+                      float *&f_cur, float *&f_upd, double &t_now, double t_next)
+{
+  double dt = this->GetTimeStep(lap);
+  for(; t_now < t_next - dt/2; t_now += dt)
     {
-    nbr[it->first]++; 
-    nbr[it->second]++;
+    lap.ExplicitStep(dt, nc, f_cur, f_upd, m_Precision == MIXED);
+    std::swap(f_cur, f_upd);
     }
+}
 
-  // Create an array for the updates
-  vtkDataArray *f = mesh->GetCellData()->GetArray(array.c_str());
-  vtkDoubleArray *f_upd = vtkDoubleArray::New();
-  f_upd->SetNumberOfComponents(f->GetNumberOfComponents());
-  f_upd->SetNumberOfTuples(f->GetNumberOfTuples());
-
-  // Copy f to f_upd
-  for(int i = 0; i < f->GetNumberOfTuples(); i++)
-    for(int j = 0; j < f->GetNumberOfComponents(); j++)
-      f_upd->SetComponent(i, j, f->GetComponent(i, j));
 
-  // Iterate
-  unsigned int jt = 0;
-  for(double t = 0; t < time - m_DeltaT/2; t+=m_DeltaT)
+void
+DiffuseArray::Advance(const MeshAdjacency &adj, GraphLaplacian &lap, int nc,
+                      double *&f_cur, double *&f_upd, double &t_now, double t_next)
+{
+  vtkIdType n = adj.GetNumberOfNodes();
+  double dt = this->GetTimeStep(lap);
+  if(m_Scheme == EXPLICIT)
     {
-    // Update f_upd
-    for(EdgeSet::iterator it = edges.begin(); it!=edges.end(); ++it)
+    for(; t_now < t_next - dt/2; t_now += dt)
       {
-      double wa = m_DeltaT / nbr[it->first];
-      double wb = m_DeltaT / nbr[it->second];
-      int ia = it->first;
-      int ib = it->second;
-
-      for(int j = 0; j < f->GetNumberOfComponents(); j++)
-        {
-        f_upd->SetComponent(ia, j, 
-          f_upd->GetComponent(ia, j) + wa * (f->GetComponent(ib,j) - f->GetComponent(ia, j)));
-        f_upd->SetComponent(ib, j, 
-          f_upd->GetComponent(ib, j) + wb * (f->GetComponent(ia,j) - f->GetComponent(ib, j)));
-        }
+      lap.ExplicitStep(dt, nc, f_cur, f_upd);
+      std::swap(f_cur, f_upd);
       }
-
-    // Copy f_upd to f
-    for(int i = 0; i < f->GetNumberOfTuples(); i++)
-      for(int j = 0; j < f->GetNumberOfComponents(); j++)
-        f->SetComponent(i, j, f_upd->GetComponent(i, j));
+    }
+  else if(m_Scheme == SPECTRAL && t_next > t_now)
+    {
+    // Evaluate the heat kernel in the truncated eigenbasis. The kernels
+    // compose, so we can go from one time to the next
+    const SpectralBasis &basis = this->GetSpectralBasis(adj, lap);
+    basis.ApplyHeatKernel(t_next - t_now, nc, f_cur, f_upd, this->GetThreadPool());
+    std::swap(f_cur, f_upd);
+    t_now = t_next;
+    }
+  else if(m_Scheme == IMPLICIT)
+    {
+    // Round the number of steps so that we land exactly on the next time
+    int n_steps = (int) std::ceil((t_next - t_now) / dt - 1e-6);
+    for(int j = 0; j < n_steps; j++)
+      {
+      std::copy(f_cur, f_cur + n * nc, f_upd);
+      int iter = lap.ImplicitStep((t_next - t_now) / n_steps, nc, f_cur, f_upd,
+                                  1e-8, MaxImplicitIterations);
+      this->Debug("  implicit step %d of %d: %d CG iterations\n", j + 1, n_steps, iter);
+      if(iter >= MaxImplicitIterations)
+        this->Info("Warning: implicit step %d of %d did not converge in %d CG iterations\n",
+                   j + 1, n_steps, iter);
+      std::swap(f_cur, f_upd);
+      }
+    t_now = t_next;
+    }
+  else if(m_Scheme == RKL && t_next > t_now)
+    {
+    // Equal super steps landing exactly on the next time, each with as few
+    // stages as stability allows. By default, long intervals are covered by
+    // DefaultSuperSteps steps, whose stages grow with the square root of
+    // the interval, so the cost grows more slowly than for EXPLICIT. An
+    // interval much shorter than dt still takes one step
+    int n_steps = std::max(1, (int) std::ceil((t_next - t_now) / dt - 1e-6));
+    if(m_DeltaT <= 0.0)
+      n_steps = std::min(n_steps, DefaultSuperSteps);
+    double tau = (t_next - t_now) / n_steps;
+    int s = GraphLaplacian::GetSuperTimeStepStages(tau, lap.GetStableTimeStep());
+    this->Debug("  %d super steps of length %f with %d stages\n", n_steps, tau, s);
+    for(int j = 0; j < n_steps; j++)
+      {
+      lap.SuperTimeStep(tau, s, nc, f_cur, f_upd);
+      std::swap(f_cur, f_upd);
+      }
+    t_now = t_next;
     }
 }
@@ -23,19 +23,60 @@
 
 =========================================================================*/
 #include "DumpArray.h"
+#include "BinaryArrayFile.h"
 #include "CommandLineHelper.h"
+#include "ScratchStore.h"
+#include "TextWriter.h"
 #include "vtkPolyData.h"
 #include "vtkPointData.h"
 #include "vtkCellData.h"
+#include <algorithm>
+#include <type_traits>
+
+namespace dump_array {
+
+// Write the tuples of an array as rows of text, in the type of the array
+template <class T>
+void WriteRows(TextWriter &tw, const T *data, vtkIdType nt, int nc)
+{
+  for(vtkIdType i = 0; i < nt; i++, data += nc)
+    {
+    for(int j = 0; j < nc; j++)
+      {
+      // Characters are written as numbers
+      if constexpr(std::is_same<T, char>::value)
+        tw << (int) data[j];
+      else
+        tw << data[j];
+      tw << (j + 1 < nc ? ' ' : '\n');
+      }
+    }
+}
+
+} // namespace
+
+using namespace dump_array;
 
 bool
 DumpArray::Parse(CommandLineHelper &cl)
 {
-  if(!cl.try_command("-da", "-dump-array"))
-    return false;
+  if(cl.try_command("-da", "-dump-array"))
+    {
+    string array = cl.read_string();
+    string fout = cl.read_output_filename();
+    this->Schedule([=]() { this->Run(array, fout); });
+    return true;
+    }
+
+  // Option that applies to subsequent -dump-array commands
+  if(cl.try_command("-da-precision", "-dump-array-precision"))
+    {
+    int digits = (int) cl.read_integer();
+    this->Schedule([=]() { this->SetPrecision(digits); });
+    return true;
+    }
 
-  this->Run(cl.read_string(), cl.read_output_filename());
-  return true;
+  return false;
 }
 
 void
@@ -47,19 +88,37 @@ DumpArray::Run(const string &array, const string &fout)
   // Get the array - this will crash if the array is missing
   DataArrayPointer arr = this->GetDataArray(p, array);
 
-  // Create a stream
-  std::ofstream fs(fout.c_str());
+  // Binary output writes the array buffer as it is
+  if(fout.length() >= 4 && fout.rfind(".npy") == fout.length() - 4)
+    {
+    BinaryArrayFile::WriteNumpy(arr, fout, this->GetScratchStore());
+    return;
+    }
+  if(fout.length() >= 4 && fout.rfind(".raw") == fout.length() - 4)
+    {
+    BinaryArrayFile::WriteRaw(arr, fout, this->GetScratchStore());
+    return;
+    }
 
-  // Write the array values
-  for(int iPoint = 0; iPoint < arr->GetNumberOfTuples(); iPoint++)
+  // Write the array values as text, a chunk of tuples at a time, and drop
+  // each chunk from memory when the array is in a scratch file
+  TextWriter tw(fout);
+  tw.SetPrecision(m_Precision);
+  vtkIdType nt = arr->GetNumberOfTuples();
+  int nc = arr->GetNumberOfComponents();
+  vtkIdType chunk = this->GetScratchStore()->GetChunkSize(nt, nc * arr->GetDataTypeSize());
+  for(vtkIdType i0 = 0; i0 < nt; i0 += chunk)
     {
-    for(int iComp = 0; iComp < arr->GetNumberOfComponents(); iComp++)
+    vtkIdType i1 = std::min(nt, i0 + chunk);
+    void *data = arr->GetVoidPointer(i0 * nc);
+    switch(arr->GetDataType())
       {
-      fs << arr->GetComponent(iPoint, iComp);
-      if(iComp + 1 < arr->GetNumberOfComponents())
-        fs << " ";
-      else
-        fs << std::endl;
+      vtkTemplateMacro(WriteRows(tw, static_cast<const VTK_TT *>(data), i1 - i0, nc));
+      default:
+        this->ThrowException("Array %s of type %s cannot be written as text",
+          array.c_str(), arr->GetDataTypeAsString());
       }
+    ScratchStore::Release(arr, i0, i1);
     }
+  tw.Close();
 }
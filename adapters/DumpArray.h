@@ -36,13 +36,27 @@ public:
   MESH3D_STANDARD_TYPEDEFS
 
   // Basic constructor
-  DumpArray(Converter *c) : CommandAdapter(c) {}
+  DumpArray(Converter *c) : CommandAdapter(c), m_Precision(0) {}
 
   /** The command-line parsing functionality */
   bool Parse(CommandLineHelper &cl);
 
-  /** The main entrypoint for the API */
+  /**
+   * The main entrypoint for the API. Files ending in .npy and .raw get the
+   * values in binary form, in the type of the array, other files get one
+   * row of text per tuple
+   */
   void Run(const string &array, const string &fout);
+
+  /**
+   * Set the number of significant digits of floating point values in text
+   * output, or zero for the shortest form that reads back exactly
+   */
+  void SetPrecision(int digits) { m_Precision = digits; }
+
+protected:
+
+  int m_Precision;
 };
 
 #endif
@@ -34,7 +34,7 @@ PrintInfo::Parse(CommandLineHelper &cl)
   if(!cl.try_command("-info"))
     return false;
 
-  this->Run();
+  this->Schedule([=]() { this->Run(); });
 
   return true;
 }
@@ -24,10 +24,16 @@
 =========================================================================*/
 #include "ReadMesh.h"
 #include "CommandLineHelper.h"
+#include "MeshCache.h"
+#include "NativeMeshFile.h"
+#include "AsciiPolyDataReader.h"
+#include "PolygonMeshFile.h"
+#include "PlyMeshFile.h"
 
 #include <vtkBYUReader.h>
 #include <vtkSTLReader.h>
 #include <vtkPolyDataReader.h>
+#include <vtkXMLPolyDataReader.h>
 #include <vtkOBJReader.h>
 
 bool
@@ -36,7 +42,8 @@ ReadMesh::Parse(CommandLineHelper &cl)
   // If the commandline has something that does not start with a '-' we take it
   if(cl.peek_arg()[0] != '-' || cl.try_command("-i"))
     {
-    this->Run(cl.read_existing_filename());
+    string fn = cl.read_existing_filename();
+    this->Schedule([=]() { this->Run(fn); });
 
     return true;
     }
@@ -48,40 +55,96 @@ void
 ReadMesh::Run(const string &fn)
 {
    vtkPolyData *p1 = NULL;
+   vtkSmartPointer<vtkPolyData> mesh;
+
+  // The server keeps the meshes it has read
+  MeshCache *cache = this->GetMeshCache();
+  if(cache)
+    {
+    std::shared_ptr<MeshCacheEntry> entry = cache->Find(fn);
+    if(entry)
+      {
+      this->Debug("Using cached mesh %s\n", fn.c_str());
+      this->PushCached(entry);
+      return;
+      }
+    }
 
   // Choose the reader based on extension
   if(fn.rfind(".byu") == fn.length() - 4)
     {
-    vtkBYUReader *reader = vtkBYUReader::New();
+    vtkSmartPointer<vtkBYUReader> reader = vtkSmartPointer<vtkBYUReader>::New();
     reader->SetFileName(fn.c_str());
     reader->Update();
-    p1 = reader->GetOutput();
+    mesh = reader->GetOutput();
+    p1 = mesh;
     }
   else if(fn.rfind(".stl") == fn.length() - 4)
     {
-    vtkSTLReader *reader = vtkSTLReader::New();
+    vtkSmartPointer<vtkSTLReader> reader = vtkSmartPointer<vtkSTLReader>::New();
     reader->SetFileName(fn.c_str());
     reader->Update();
-    p1 = reader->GetOutput();
+    mesh = reader->GetOutput();
+    p1 = mesh;
     }
   else if(fn.rfind(".vtk") == fn.length() - 4)
     {
-    vtkPolyDataReader *reader = vtkPolyDataReader::New();
+    // Try the parallel reader for ASCII files first
+    AsciiPolyDataReader fast_reader(this->GetThreadPool());
+    mesh = fast_reader.Read(fn);
+    if(mesh)
+      {
+      p1 = mesh;
+      }
+    else
+      {
+      this->Debug("Reading %s with vtkPolyDataReader: %s\n", fn.c_str(),
+                  fast_reader.GetUnsupportedReason().c_str());
+      vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
+      reader->SetFileName(fn.c_str());
+      reader->Update();
+      mesh = reader->GetOutput();
+      p1 = mesh;
+      }
+    }
+  else if(fn.rfind(".vtp") == fn.length() - 4)
+    {
+    vtkSmartPointer<vtkXMLPolyDataReader> reader = vtkSmartPointer<vtkXMLPolyDataReader>::New();
     reader->SetFileName(fn.c_str());
     reader->Update();
-    p1 = reader->GetOutput();
+    mesh = reader->GetOutput();
+    p1 = mesh;
     }
   else if(fn.rfind(".obj") == fn.length() - 4)
     {
-    vtkOBJReader *reader = vtkOBJReader::New();
+    vtkSmartPointer<vtkOBJReader> reader = vtkSmartPointer<vtkOBJReader>::New();
     reader->SetFileName(fn.c_str());
     reader->Update();
-    p1 = reader->GetOutput();
+    mesh = reader->GetOutput();
+    p1 = mesh;
+    }
+  else if(fn.rfind(".off") == fn.length() - 4)
+    {
+    mesh = PolygonMeshFile::ReadOFF(fn);
+    p1 = mesh;
+    }
+  else if(fn.rfind(".ply") == fn.length() - 4)
+    {
+    mesh = PlyMeshFile::Read(fn);
+    p1 = mesh;
+    }
+  else if(fn.rfind(".m3d") == fn.length() - 4)
+    {
+    mesh = NativeMeshFile::Read(fn);
+    p1 = mesh;
     }
   else
     {
     this->ThrowException("No mesh reader configured for filename %s", fn.c_str());
     }
 
-  this->Push(p1);
+  if(cache)
+    this->PushCached(cache->Insert(fn, p1));
+  else
+    this->Push(p1);
 }
@@ -0,0 +1,406 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    ReorderMesh.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "ReorderMesh.h"
+#include "CommandLineHelper.h"
+#include "MeshAdjacency.h"
+#include "ThreadPool.h"
+#include "vtkPolyData.h"
+#include "vtkPointData.h"
+#include "vtkCellData.h"
+#include "vtkCellArray.h"
+#include "vtkIdList.h"
+#include "vtkIdTypeArray.h"
+#include "vtkPoints.h"
+#include <algorithm>
+#include <stdint.h>
+
+namespace reorder_mesh {
+
+// Number of bits per axis of the space-filling curve codes
+const int CurveBits = 21;
+
+// Find the end of a long path in the component of the graph containing
+// start (a pseudo-peripheral node), by repeated breadth-first search from
+// the lowest degree node in the last level found. The level array holds
+// -1 for nodes not yet reached by any search
+vtkIdType FindPeripheralNode(const MeshAdjacency &adj, vtkIdType start,
+                             std::vector<int> &level, std::vector<vtkIdType> &queue)
+{
+  const vtkIdType *offset = adj.GetOffsets();
+  const MeshAdjacency::IndexType *nbr = adj.GetNeighbors();
+  int eccentricity = -1;
+  for(int pass = 0; pass < 8; pass++)
+    {
+    // Breadth-first search, the levels are reset for the component afterwards
+    queue.assign(1, start);
+    level[start] = 0;
+    for(size_t q = 0; q < queue.size(); q++)
+      {
+      vtkIdType i = queue[q];
+      for(vtkIdType k = offset[i]; k < offset[i+1]; k++)
+        if(level[nbr[k]] < 0)
+          {
+          level[nbr[k]] = level[i] + 1;
+          queue.push_back(nbr[k]);
+          }
+      }
+
+    int depth = level[queue.back()];
+    vtkIdType best = queue.back();
+    for(size_t q = queue.size(); q > 0 && level[queue[q-1]] == depth; q--)
+      if(adj.GetDegree(queue[q-1]) < adj.GetDegree(best))
+        best = queue[q-1];
+
+    for(size_t q = 0; q < queue.size(); q++)
+      level[queue[q]] = -1;
+
+    if(depth <= eccentricity)
+      break;
+    eccentricity = depth;
+    start = best;
+    }
+
+  return start;
+}
+
+// Reverse Cuthill-McKee ordering of the vertex graph. Returns the old index
+// of each node in the new order
+std::vector<vtkIdType> ReverseCuthillMcKee(const MeshAdjacency &adj)
+{
+  vtkIdType n = adj.GetNumberOfNodes();
+  const vtkIdType *offset = adj.GetOffsets();
+  const MeshAdjacency::IndexType *nbr = adj.GetNeighbors();
+
+  // Components are started from their lowest degree nodes
+  std::vector<vtkIdType> by_degree(n);
+  for(vtkIdType i = 0; i < n; i++)
+    by_degree[i] = i;
+  std::stable_sort(by_degree.begin(), by_degree.end(),
+    [&adj](vtkIdType a, vtkIdType b) { return adj.GetDegree(a) < adj.GetDegree(b); });
+
+  std::vector<vtkIdType> order, queue, children;
+  std::vector<int> level(n, -1);
+  std::vector<unsigned char> visited(n, 0);
+  order.reserve(n);
+  for(vtkIdType s = 0; s < n; s++)
+    {
+    if(visited[by_degree[s]])
+      continue;
+
+    // Cuthill-McKee: breadth-first search, visiting the neighbors of each
+    // node in order of increasing degree
+    vtkIdType start = FindPeripheralNode(adj, by_degree[s], level, queue);
+    size_t head = order.size();
+    order.push_back(start);
+    visited[start] = 1;
+    for(; head < order.size(); head++)
+      {
+      vtkIdType i = order[head];
+      children.clear();
+      for(vtkIdType k = offset[i]; k < offset[i+1]; k++)
+        if(!visited[nbr[k]])
+          {
+          visited[nbr[k]] = 1;
+          children.push_back(nbr[k]);
+          }
+
+      std::stable_sort(children.begin(), children.end(),
+        [&adj](vtkIdType a, vtkIdType b) { return adj.GetDegree(a) < adj.GetDegree(b); });
+      order.insert(order.end(), children.begin(), children.end());
+      }
+    }
+
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+// Graph of the points of the mesh, linked by the cells of any type. The
+// points of a cell with up to four points are all linked, which gives the
+// edges of triangles and tetras, and those of longer cells such as lines,
+// polygons and strips are linked to the next two points in the cell
+void BuildPointGraph(vtkPolyData *mesh, ThreadPool *pool, MeshAdjacency &adj)
+{
+  std::vector<MeshAdjacency::Edge> edges;
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  for(vtkIdType j = 0; j < mesh->GetNumberOfCells(); j++)
+    {
+    mesh->GetCellPoints(j, ids);
+    vtkIdType k = ids->GetNumberOfIds();
+    for(vtkIdType a = 0; a < k; a++)
+      for(vtkIdType b = a + 1; b < k && (k <= 4 || b <= a + 2); b++)
+        if(ids->GetId(a) != ids->GetId(b))
+          edges.push_back(MeshAdjacency::Edge(
+            (MeshAdjacency::IndexType) ids->GetId(a), (MeshAdjacency::IndexType) ids->GetId(b)));
+    }
+
+  adj.BuildFromEdges(mesh->GetNumberOfPoints(), edges, pool);
+}
+
+// Spread the lower 21 bits of x so that there are two zero bits between them
+uint64_t SpreadBits(uint64_t x)
+{
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffULL;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL;
+  x = (x | x << 8) & 0x100f00f00f00f00fULL;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+  x = (x | x << 2) & 0x1249249249249249ULL;
+  return x;
+}
+
+// Position along the Morton (Z-order) curve, by interleaving the bits
+uint64_t MortonCode(const uint32_t X[3])
+{
+  return (SpreadBits(X[0]) << 2) | (SpreadBits(X[1]) << 1) | SpreadBits(X[2]);
+}
+
+// Position along the Hilbert curve, using the transform of Skilling (2004)
+// from coordinates to the transposed Hilbert index, whose bits are then
+// interleaved as in the Morton code
+uint64_t HilbertCode(const uint32_t X_in[3])
+{
+  uint32_t X[3] = { X_in[0], X_in[1], X_in[2] };
+  const uint32_t M = 1u << (CurveBits - 1);
+
+  // Inverse undo
+  for(uint32_t Q = M; Q > 1; Q >>= 1)
+    {
+    uint32_t P = Q - 1;
+    for(int i = 0; i < 3; i++)
+      {
+      if(X[i] & Q)
+        X[0] ^= P;
+      else
+        {
+        uint32_t t = (X[0] ^ X[i]) & P;
+        X[0] ^= t;
+        X[i] ^= t;
+        }
+      }
+    }
+
+  // Gray encode
+  for(int i = 1; i < 3; i++)
+    X[i] ^= X[i-1];
+  uint32_t t = 0;
+  for(uint32_t Q = M; Q > 1; Q >>= 1)
+    if(X[2] & Q)
+      t ^= Q - 1;
+  for(int i = 0; i < 3; i++)
+    X[i] ^= t;
+
+  return MortonCode(X);
+}
+
+// Order of the points along a space-filling curve through the bounding box.
+// Returns the old index of each point in the new order
+std::vector<vtkIdType> SpaceFillingCurveOrder(vtkPolyData *mesh, bool hilbert, ThreadPool *pool)
+{
+  vtkIdType n = mesh->GetNumberOfPoints();
+  double bounds[6];
+  mesh->GetBounds(bounds);
+
+  // The same scale along every axis, so that the curve does not stretch
+  double extent = std::max(bounds[1] - bounds[0], std::max(bounds[3] - bounds[2], bounds[5] - bounds[4]));
+  double scale = extent > 0.0 ? ((1 << CurveBits) - 1) / extent : 0.0;
+
+  std::vector<std::pair<uint64_t, vtkIdType> > code(n);
+  pool->ParallelFor(n, [&](vtkIdType begin, vtkIdType end)
+    {
+    double x[3];
+    uint32_t X[3];
+    for(vtkIdType i = begin; i < end; i++)
+      {
+      mesh->GetPoint(i, x);
+      for(int d = 0; d < 3; d++)
+        X[d] = (uint32_t) ((x[d] - bounds[2*d]) * scale);
+      code[i] = std::make_pair(hilbert ? HilbertCode(X) : MortonCode(X), i);
+      }
+    });
+
+  std::sort(code.begin(), code.end());
+  std::vector<vtkIdType> order(n);
+  for(vtkIdType i = 0; i < n; i++)
+    order[i] = code[i].second;
+  return order;
+}
+
+// Array holding the original index of each point or cell
+vtkSmartPointer<vtkIdTypeArray> MakeIndexArray(const string &name, const std::vector<vtkIdType> &order)
+{
+  vtkSmartPointer<vtkIdTypeArray> arr = vtkSmartPointer<vtkIdTypeArray>::New();
+  arr->SetName(name.c_str());
+  arr->SetNumberOfComponents(1);
+  arr->SetNumberOfTuples(order.size());
+  std::copy(order.begin(), order.end(), arr->GetPointer(0));
+  return arr;
+}
+
+} // namespace
+
+using namespace reorder_mesh;
+
+bool
+ReorderMesh::Parse(CommandLineHelper &cl)
+{
+  if(cl.try_command("-reorder-array"))
+    {
+    string name = cl.read_string();
+    this->Schedule([=]() { this->SetIndexArrayName(name); });
+    return true;
+    }
+
+  if(!cl.try_command("-reorder"))
+    return false;
+
+  // Get parameters
+  string method = cl.read_string();
+  Method m;
+  if(method == "rcm")
+    m = RCM;
+  else if(method == "morton")
+    m = MORTON;
+  else if(method == "hilbert")
+    m = HILBERT;
+  else
+    this->ThrowException("Unknown reordering method %s", method.c_str());
+
+  this->Schedule([=]() { this->Run(m); });
+
+  return true;
+}
+
+void
+ReorderMesh::Run(Method method)
+{
+  // Get mesh from stack
+  PolyDataPointer mesh = this->TopPolyData();
+  vtkIdType n = mesh->GetNumberOfPoints();
+  if(n == 0)
+    this->ThrowException("Can not reorder a mesh without points");
+
+  // Old index of each point in the new order, and the new index of each point
+  std::vector<vtkIdType> point_order;
+  if(method == RCM)
+    {
+    MeshAdjacency adj;
+    BuildPointGraph(mesh, this->GetThreadPool(), adj);
+    point_order = ReverseCuthillMcKee(adj);
+    }
+  else
+    {
+    point_order = SpaceFillingCurveOrder(mesh, method == HILBERT, this->GetThreadPool());
+    }
+
+  std::vector<vtkIdType> point_rank(n);
+  for(vtkIdType i = 0; i < n; i++)
+    point_rank[point_order[i]] = i;
+
+  // Permute the points and the point data
+  vtkSmartPointer<vtkPolyData> out = vtkSmartPointer<vtkPolyData>::New();
+  vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+  points->SetDataType(mesh->GetPoints()->GetDataType());
+  points->SetNumberOfPoints(n);
+
+  // Every array is permuted, including the global and pedigree ids, which
+  // the default copy flags of VTK leave out
+  out->GetPointData()->CopyAllOn();
+  out->GetPointData()->CopyAllocate(mesh->GetPointData(), n);
+  for(vtkIdType i = 0; i < n; i++)
+    {
+    points->SetPoint(i, mesh->GetPoint(point_order[i]));
+    out->GetPointData()->CopyData(mesh->GetPointData(), point_order[i], i);
+    }
+  out->SetPoints(points);
+
+  // VTK numbers the verts first, then the lines, polys and strips, so the
+  // cells can only be reordered within each of these arrays. Cells are
+  // sorted by their lowest new point index, which keeps the neighbors of a
+  // cell close to it as well
+  vtkCellArray *cells[] = { mesh->GetVerts(), mesh->GetLines(), mesh->GetPolys(), mesh->GetStrips() };
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  std::vector<vtkIdType> cell_order;
+  cell_order.reserve(mesh->GetNumberOfCells());
+  vtkIdType first = 0;
+  for(int a = 0; a < 4; a++)
+    {
+    vtkIdType nc = cells[a] ? cells[a]->GetNumberOfCells() : 0;
+    if(nc == 0)
+      continue;
+
+    std::vector<std::pair<vtkIdType, vtkIdType> > key(nc);
+    for(vtkIdType j = 0; j < nc; j++)
+      {
+      mesh->GetCellPoints(first + j, ids);
+      vtkIdType lowest = n;
+      for(vtkIdType k = 0; k < ids->GetNumberOfIds(); k++)
+        lowest = std::min(lowest, point_rank[ids->GetId(k)]);
+      key[j] = std::make_pair(lowest, first + j);
+      }
+    std::sort(key.begin(), key.end());
+
+    vtkSmartPointer<vtkCellArray> ca = vtkSmartPointer<vtkCellArray>::New();
+    for(vtkIdType j = 0; j < nc; j++)
+      {
+      mesh->GetCellPoints(key[j].second, ids);
+      vtkIdType *p = ids->GetPointer(0);
+      for(vtkIdType k = 0; k < ids->GetNumberOfIds(); k++)
+        p[k] = point_rank[p[k]];
+      ca->InsertNextCell(ids);
+      cell_order.push_back(key[j].second);
+      }
+
+    switch(a)
+      {
+      case 0: out->SetVerts(ca); break;
+      case 1: out->SetLines(ca); break;
+      case 2: out->SetPolys(ca); break;
+      case 3: out->SetStrips(ca); break;
+      }
+    first += nc;
+    }
+
+  // Permute the cell data
+  vtkIdType n_cells = cell_order.size();
+  out->GetCellData()->CopyAllOn();
+  out->GetCellData()->CopyAllocate(mesh->GetCellData(), n_cells);
+  for(vtkIdType j = 0; j < n_cells; j++)
+    out->GetCellData()->CopyData(mesh->GetCellData(), cell_order[j], j);
+  out->GetFieldData()->ShallowCopy(mesh->GetFieldData());
+
+  // Store the original indices
+  if(m_IndexArrayName.size())
+    {
+    out->GetPointData()->AddArray(MakeIndexArray(m_IndexArrayName, point_order));
+    out->GetCellData()->AddArray(MakeIndexArray(m_IndexArrayName, cell_order));
+    }
+
+  this->Info("Reordered %ld points and %ld cells by %s\n", (long) n, (long) n_cells,
+    method == RCM ? "reverse Cuthill-McKee" : (method == MORTON ? "Morton curve" : "Hilbert curve"));
+
+  // Replace the mesh on the stack
+  this->PopPolyData();
+  this->Push(out);
+}
@@ -0,0 +1,69 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    ReorderMesh.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __ReorderMesh_h_
+#define __ReorderMesh_h_
+
+#include "CommandAdapter.h"
+
+class ReorderMesh : public CommandAdapter
+{
+public:
+
+  // Orderings of the points. RCM (reverse Cuthill-McKee) walks the graph of
+  // points linked by cells breadth first, so that neighbors get nearby
+  // indices. MORTON and HILBERT sort the points along a space-filling curve
+  // through the bounding box
+  enum Method { RCM, MORTON, HILBERT };
+
+  // Common typedefs
+  MESH3D_STANDARD_TYPEDEFS
+
+  // Basic constructor
+  ReorderMesh(Converter *c) : CommandAdapter(c) {}
+
+  /** The command-line parsing functionality */
+  bool Parse(CommandLineHelper &cl);
+
+  /**
+   * The main entrypoint for the API. Replaces the mesh at the top of the
+   * stack with a copy whose points are in the given order and whose cells
+   * are sorted by their lowest point index, with all point and cell data
+   * permuted to match
+   */
+  void Run(Method method);
+
+  /**
+   * Set the name of the arrays in which the original index of each point
+   * and cell is stored, so that results can be mapped back. Empty by
+   * default, in which case the arrays are not created
+   */
+  void SetIndexArrayName(const string &name) { m_IndexArrayName = name; }
+
+protected:
+
+  string m_IndexArrayName;
+};
+
+#endif
@@ -24,26 +24,54 @@
 =========================================================================*/
 #include "WriteMesh.h"
 #include "CommandLineHelper.h"
+#include "NativeMeshFile.h"
+#include "PolygonMeshFile.h"
+#include "PlyMeshFile.h"
 
 #include <vtkPolyData.h>
 #include <vtkBYUWriter.h>
 #include <vtkSTLWriter.h>
 #include <vtkPolyDataWriter.h>
-#include <vtkOBJExporter.h>
-#include <vtkOOGLExporter.h>
-#include <vtkRenderWindow.h>
-#include <vtkRenderer.h>
-#include <vtkActor.h>
-#include <vtkPolyDataMapper.h>
+#include <vtkXMLPolyDataWriter.h>
+#include <vtkZLibDataCompressor.h>
+#include <vtkVersion.h>
+#if VTK_MAJOR_VERSION > 8 || (VTK_MAJOR_VERSION == 8 && VTK_MINOR_VERSION >= 1)
+#include <vtkLZ4DataCompressor.h>
+#endif
 
 bool
 WriteMesh::Parse(CommandLineHelper &cl)
 {
   if(cl.try_command("-o"))
     {
-    this->Run(cl.read_output_filename());
+    string fn = cl.read_output_filename();
+    this->Schedule([=]() { this->Run(fn); });
     return true;
     }
+
+  // Options that apply to subsequent -o commands
+  if(cl.try_command("-o-binary"))
+    {
+    this->Schedule([=]() { this->SetBinary(true); });
+    return true;
+    }
+
+  if(cl.try_command("-o-compress"))
+    {
+    string comp = cl.read_string();
+    Compression value;
+    if(comp == "none")
+      value = NONE;
+    else if(comp == "zlib")
+      value = ZLIB;
+    else if(comp == "lz4")
+      value = LZ4;
+    else
+      this->ThrowException("Unknown compression %s", comp.c_str());
+    this->Schedule([=]() { this->SetCompression(value); });
+    return true;
+    }
+
   return false;
 }
 
@@ -55,63 +83,85 @@ WriteMesh::Run(const string &fn)
 
   if(fn.rfind(".byu") == fn.length() - 4)
     {
-    vtkBYUWriter *writer = vtkBYUWriter::New();
+    vtkSmartPointer<vtkBYUWriter> writer = vtkSmartPointer<vtkBYUWriter>::New();
     writer->SetGeometryFileName(fn.c_str());
     writer->SetInputData(data);
     writer->Update();
     }
   else if(fn.rfind(".stl") == fn.length() - 4)
     {
-    vtkSTLWriter *writer = vtkSTLWriter::New();
+    vtkSmartPointer<vtkSTLWriter> writer = vtkSmartPointer<vtkSTLWriter>::New();
     writer->SetFileName(fn.c_str());
     writer->SetInputData(data);
     writer->Update();
     }
   else if(fn.rfind(".vtk") == fn.length() - 4)
     {
-    vtkPolyDataWriter *writer = vtkPolyDataWriter::New();
+    vtkSmartPointer<vtkPolyDataWriter> writer = vtkSmartPointer<vtkPolyDataWriter>::New();
     writer->SetFileName(fn.c_str());
     writer->SetInputData(data);
+    if(m_Binary)
+      writer->SetFileTypeToBinary();
     writer->Update();
     }
-  else if(fn.rfind(".obj") == fn.length() - 4)
+  else if(fn.rfind(".vtp") == fn.length() - 4)
     {
-    vtkRenderer *renderer = vtkRenderer::New();
-    vtkPolyDataMapper *myDataMapper = vtkPolyDataMapper::New();
-    myDataMapper->SetInputData(data);
-    vtkActor *myActor = vtkActor::New();
-    myActor->SetMapper(myDataMapper);
-    renderer->AddActor(myActor);
-    vtkRenderWindow *renWin = vtkRenderWindow::New();
-    renWin->AddRenderer(renderer);
-
-    vtkOBJExporter *writer = vtkOBJExporter::New();
-    string prefix = fn.substr(0, fn.length() - 4);
-    writer->SetFilePrefix(prefix.c_str());
-    writer->SetRenderWindow(renWin);
+    // XML format with the data in raw appended blocks, which are written
+    // and read without base64 encoding. 64-bit block headers allow arrays
+    // larger than 4GB
+    vtkSmartPointer<vtkXMLPolyDataWriter> writer = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
+    writer->SetFileName(fn.c_str());
+    writer->SetInputData(data);
+    writer->SetDataModeToAppended();
+    writer->EncodeAppendedDataOff();
+    writer->SetHeaderTypeToUInt64();
+    if(m_Compression == ZLIB)
+      {
+      vtkSmartPointer<vtkZLibDataCompressor> zlib = vtkSmartPointer<vtkZLibDataCompressor>::New();
+      writer->SetCompressor(zlib);
+      }
+    else if(m_Compression == LZ4)
+      {
+#if VTK_MAJOR_VERSION > 8 || (VTK_MAJOR_VERSION == 8 && VTK_MINOR_VERSION >= 1)
+      vtkSmartPointer<vtkLZ4DataCompressor> lz4 = vtkSmartPointer<vtkLZ4DataCompressor>::New();
+      writer->SetCompressor(lz4);
+#else
+      this->ThrowException("LZ4 compression requires VTK 8.1 or later");
+#endif
+      }
+    else
+      {
+      writer->SetCompressor(NULL);
+      }
     writer->Update();
     }
+  else if(fn.rfind(".obj") == fn.length() - 4)
+    {
+    PolygonMeshFile::WriteOBJ(data, fn);
+    }
   else if(fn.rfind(".off") == fn.length() - 4)
     {
-    vtkRenderer *renderer = vtkRenderer::New();
-    vtkPolyDataMapper *myDataMapper = vtkPolyDataMapper::New();
-    myDataMapper->SetInputData(data);
-    vtkActor *myActor = vtkActor::New();
-    myActor->SetMapper(myDataMapper);
-    renderer->AddActor(myActor);
-    vtkRenderWindow *renWin = vtkRenderWindow::New();
-    renWin->AddRenderer(renderer);
-
-    vtkOOGLExporter *writer = vtkOOGLExporter::New();
-    writer->SetFileName(fn.c_str());
-    writer->SetRenderWindow(renWin);
-    writer->Update();
+    vtkIdType n_skipped = PolygonMeshFile::WriteOFF(data, fn);
+    if(n_skipped)
+      this->Info("%ld vertex and line cells were not saved to %s\n", (long) n_skipped, fn.c_str());
+    }
+  else if(fn.rfind(".ply") == fn.length() - 4)
+    {
+    std::vector<std::string> skipped;
+    PlyMeshFile::Write(data, fn, &skipped);
+    for(unsigned int i = 0; i < skipped.size(); i++)
+      this->Info("Array %s cannot be stored in PLY and was not saved to %s\n", skipped[i].c_str(), fn.c_str());
+    }
+  else if(fn.rfind(".m3d") == fn.length() - 4)
+    {
+    std::vector<std::string> skipped;
+    NativeMeshFile::Write(data, fn, &skipped);
+    for(unsigned int i = 0; i < skipped.size(); i++)
+      this->Info("Array %s is not numeric and was not saved to %s\n", skipped[i].c_str(), fn.c_str());
     }
   else
     {
-    cout << "Could not find a writer for " << fn << endl;
-    cout << fn.rfind(".byu") << endl;
-    cout << fn.rfind(".vtk") << endl;
+    this->Info("Could not find a writer for %s\n", fn.c_str());
     return;
     }
 }
@@ -32,10 +32,14 @@ class WriteMesh : public CommandAdapter
 {
 public:
 
+  // Compression of the data blocks in .vtp files
+  enum Compression { NONE, ZLIB, LZ4 };
+
   // Common typedefs
   MESH3D_STANDARD_TYPEDEFS
 
-  WriteMesh(Converter *c) : CommandAdapter(c) {}
+  WriteMesh(Converter *c)
+    : CommandAdapter(c), m_Binary(false), m_Compression(NONE) {}
 
   /** The command-line parsing functionality */
   bool Parse(CommandLineHelper &cl);
@@ -43,6 +47,19 @@ public:
   /** The main entrypoint for the API */
   void Run(const string &fn);
 
+  /** Write legacy .vtk files in binary rather than ASCII */
+  void SetBinary(bool binary) { m_Binary = binary; }
+
+  /**
+   * Set the compression of .vtp files, which store their data as raw
+   * appended blocks when not compressed
+   */
+  void SetCompression(Compression comp) { m_Compression = comp; }
+
+protected:
+
+  bool m_Binary;
+  Compression m_Compression;
 };
 
 #endif
@@ -0,0 +1,534 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    AsciiPolyDataReader.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "AsciiPolyDataReader.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <vtkPolyData.h>
+#include <vtkPoints.h>
+#include <vtkPointData.h>
+#include <vtkCellData.h>
+#include <vtkCellArray.h>
+#include <vtkDataArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkTypeInt64Array.h>
+#include <vtkVersion.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace ascii_polydata_reader {
+
+// Thrown when the file uses a feature that the reader does not handle
+class Unsupported : public std::runtime_error
+{
+public:
+  Unsupported(const std::string &reason) : std::runtime_error(reason) {}
+};
+
+// Smallest part of a section that is worth parsing on its own thread
+const vtkIdType MinChunkSize = 1 << 16;
+
+inline bool IsSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Current position in the file
+struct Cursor
+{
+  const char *p, *end;
+};
+
+std::string Upper(std::string s)
+{
+  for(size_t i = 0; i < s.size(); i++)
+    s[i] = toupper(s[i]);
+  return s;
+}
+
+// Read the rest of the line, without the line break
+std::string ReadLine(Cursor &cur)
+{
+  const char *eol = (const char *) memchr(cur.p, '\n', cur.end - cur.p);
+  std::string line(cur.p, eol ? eol : cur.end);
+  cur.p = eol ? eol + 1 : cur.end;
+  if(line.size() && line[line.size() - 1] == '\r')
+    line.resize(line.size() - 1);
+  return line;
+}
+
+// Split the next line that is not blank into tokens, none at the end of file
+std::vector<std::string> ReadTokens(Cursor &cur)
+{
+  std::vector<std::string> tokens;
+  while(tokens.empty() && cur.p < cur.end)
+    {
+    std::string line = ReadLine(cur);
+    for(size_t i = 0; i < line.size(); )
+      {
+      size_t j = i;
+      while(j < line.size() && !IsSpace(line[j]))
+        j++;
+      if(j > i)
+        tokens.push_back(line.substr(i, j - i));
+      i = j + 1;
+      }
+    }
+  return tokens;
+}
+
+std::vector<std::string> PeekTokens(Cursor cur)
+{
+  return ReadTokens(cur);
+}
+
+// Parse a count from a header line
+vtkIdType ToId(const std::string &s)
+{
+  long long v = 0;
+  std::from_chars_result r = std::from_chars(s.data(), s.data() + s.size(), v);
+  if(r.ec != std::errc() || r.ptr != s.data() + s.size() || v < 0)
+    throw Unsupported("invalid count " + s);
+  return (vtkIdType) v;
+}
+
+// Array names are written with special characters as %xx
+std::string DecodeName(const std::string &s)
+{
+  std::string out;
+  for(size_t i = 0; i < s.size(); i++)
+    {
+    if(s[i] == '%' && i + 2 < s.size() && isxdigit(s[i+1]) && isxdigit(s[i+2]))
+      {
+      out.push_back((char) strtol(s.substr(i + 1, 2).c_str(), NULL, 16));
+      i += 2;
+      }
+    else out.push_back(s[i]);
+    }
+  return out;
+}
+
+// VTK data type for the type names of the legacy format
+int GetDataType(const std::string &name)
+{
+  static const char *names[] = {
+    "unsigned_char", "char", "signed_char", "short", "unsigned_short", "int",
+    "unsigned_int", "long", "unsigned_long", "float", "double", "vtkidtype",
+    "vtktypeint64", "vtktypeuint64" };
+  static const int types[] = {
+    VTK_UNSIGNED_CHAR, VTK_CHAR, VTK_SIGNED_CHAR, VTK_SHORT, VTK_UNSIGNED_SHORT, VTK_INT,
+    VTK_UNSIGNED_INT, VTK_LONG, VTK_UNSIGNED_LONG, VTK_FLOAT, VTK_DOUBLE, VTK_ID_TYPE,
+    VTK_TYPE_INT64, VTK_TYPE_UINT64 };
+
+  std::string lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  for(unsigned int i = 0; i < sizeof(types) / sizeof(int); i++)
+    if(lower == names[i])
+      return types[i];
+  throw Unsupported("data type " + name);
+}
+
+// Whether a line, starting at its first character that is not blank, holds
+// numbers rather than a keyword or an array name
+bool IsNumericLine(const char *p, const char *end)
+{
+  if((*p >= '0' && *p <= '9') || *p == '-' || *p == '.')
+    return true;
+
+  // Words such as nan and inf
+  double v;
+  std::from_chars_result r = std::from_chars(p, end, v);
+  return r.ec == std::errc() && (r.ptr == end || IsSpace(*r.ptr));
+}
+
+// Find the end of the numeric section that starts at p, which is the first
+// line that is not blank and does not hold numbers
+const char *FindSectionEnd(const char *p, const char *end)
+{
+  while(p < end)
+    {
+    const char *q = p;
+    while(q < end && (*q == ' ' || *q == '\t' || *q == '\r'))
+      q++;
+    if(q < end && *q != '\n' && !IsNumericLine(q, end))
+      return p;
+    const char *eol = (const char *) memchr(q, '\n', end - q);
+    p = eol ? eol + 1 : end;
+    }
+  return end;
+}
+
+// Parse all the values in a part of a section, appending them to out
+template <class T>
+void ParseValues(const char *p, const char *end, std::vector<T> &out)
+{
+  while(true)
+    {
+    while(p < end && IsSpace(*p))
+      p++;
+    if(p == end)
+      return;
+
+    T v;
+    std::from_chars_result r = std::from_chars(p, end, v);
+    if(r.ec != std::errc() || (r.ptr < end && !IsSpace(*r.ptr)))
+      throw Unsupported("value " + std::string(p, std::find_if(p, end, IsSpace)));
+    out.push_back(v);
+    p = r.ptr;
+    }
+}
+
+void RunParallel(ThreadPool *pool, vtkIdType n, const ThreadPool::RangeFunction &body)
+{
+  if(pool)
+    pool->ParallelFor(n, body);
+  else
+    body(0, n);
+}
+
+// Parse the n values of the numeric section at the cursor. The section is
+// split into chunks at whitespace, which are parsed in parallel, and the
+// values of each chunk are then copied to their place in the output
+template <class T>
+void ParseSection(ThreadPool *pool, Cursor &cur, vtkIdType n, T *out)
+{
+  const char *begin = cur.p, *end = FindSectionEnd(cur.p, cur.end);
+  vtkIdType size = end - begin;
+  vtkIdType n_threads = pool ? pool->GetNumberOfThreads() : 1;
+  vtkIdType n_chunks = std::max((vtkIdType) 1, std::min(4 * n_threads, size / MinChunkSize));
+
+  std::vector<const char *> split(n_chunks + 1);
+  for(vtkIdType c = 0; c <= n_chunks; c++)
+    {
+    const char *q = begin + size * c / n_chunks;
+    while(c > 0 && q < end && !IsSpace(*q))
+      q++;
+    split[c] = q;
+    }
+
+  std::vector<std::vector<T> > values(n_chunks);
+  RunParallel(pool, n_chunks, [&](vtkIdType c0, vtkIdType c1)
+    {
+    for(vtkIdType c = c0; c < c1; c++)
+      {
+      values[c].reserve((split[c + 1] - split[c]) / 2);
+      ParseValues(split[c], split[c + 1], values[c]);
+      }
+    });
+
+  std::vector<vtkIdType> start(n_chunks + 1, 0);
+  for(vtkIdType c = 0; c < n_chunks; c++)
+    start[c + 1] = start[c] + values[c].size();
+  if(start[n_chunks] != n)
+    throw Unsupported("section with " + std::to_string((long long) start[n_chunks])
+      + " values where " + std::to_string((long long) n) + " were expected");
+
+  RunParallel(pool, n_chunks, [&](vtkIdType c0, vtkIdType c1)
+    {
+    for(vtkIdType c = c0; c < c1; c++)
+      {
+      std::copy(values[c].begin(), values[c].end(), out + start[c]);
+      std::vector<T>().swap(values[c]);
+      }
+    });
+
+  cur.p = end;
+}
+
+// Parse a section into an array of any numeric type
+void ParseArray(ThreadPool *pool, Cursor &cur, vtkDataArray *arr)
+{
+  vtkIdType n = arr->GetNumberOfTuples() * arr->GetNumberOfComponents();
+  void *out = arr->GetVoidPointer(0);
+  switch(arr->GetDataType())
+    {
+    vtkTemplateMacro(ParseSection(pool, cur, n, static_cast<VTK_TT *>(out)));
+    default:
+      throw Unsupported(std::string("array type ") + arr->GetDataTypeAsString());
+    }
+}
+
+vtkSmartPointer<vtkDataArray> NewArray(int type, int nc, vtkIdType nt, const std::string &name)
+{
+  if(nc < 1)
+    throw Unsupported("array without components");
+
+  vtkSmartPointer<vtkDataArray> arr;
+  arr.TakeReference(vtkDataArray::CreateDataArray(type));
+  arr->SetNumberOfComponents(nc);
+  arr->SetNumberOfTuples(nt);
+  if(name.size())
+    arr->SetName(name.c_str());
+  return arr;
+}
+
+// Skip the metadata that may follow an array, such as the value ranges
+// that VTK caches. Component names are not supported
+void SkipMetaData(Cursor &cur)
+{
+  std::vector<std::string> tok = PeekTokens(cur);
+  if(tok.size() != 1 || Upper(tok[0]) != "METADATA")
+    return;
+
+  ReadTokens(cur);
+  while(cur.p < cur.end)
+    {
+    std::string line = ReadLine(cur);
+    if(line.find_first_not_of(" \t") == std::string::npos)
+      break;
+    if(Upper(line).compare(0, 15, "COMPONENT_NAMES") == 0)
+      throw Unsupported("component names");
+    }
+}
+
+// Read the cells of one kind, in the classic layout where each cell is
+// written as its number of points followed by the point ids, or in the
+// layout of version 5.1 of the format with offsets and connectivity
+vtkSmartPointer<vtkCellArray> ReadCells(ThreadPool *pool, Cursor &cur,
+                                        vtkIdType n1, vtkIdType n2, vtkIdType n_points)
+{
+  vtkSmartPointer<vtkCellArray> ca = vtkSmartPointer<vtkCellArray>::New();
+  std::vector<std::string> tok = PeekTokens(cur);
+  if(tok.size() == 2 && Upper(tok[0]) == "OFFSETS")
+    {
+    // Here n1 is the number of offsets and n2 the size of the connectivity
+    ReadTokens(cur);
+    vtkSmartPointer<vtkTypeInt64Array> offsets = vtkSmartPointer<vtkTypeInt64Array>::New();
+    offsets->SetNumberOfValues(n1);
+    ParseSection(pool, cur, n1, offsets->GetPointer(0));
+
+    tok = ReadTokens(cur);
+    if(tok.size() != 2 || Upper(tok[0]) != "CONNECTIVITY")
+      throw Unsupported("offsets without connectivity");
+    vtkSmartPointer<vtkTypeInt64Array> conn = vtkSmartPointer<vtkTypeInt64Array>::New();
+    conn->SetNumberOfValues(n2);
+    ParseSection(pool, cur, n2, conn->GetPointer(0));
+
+    const vtkTypeInt64 *off = offsets->GetPointer(0), *ids = conn->GetPointer(0);
+    vtkIdType nc = std::max(n1, (vtkIdType) 1) - 1;
+    bool valid = n1 > 0 ? off[0] == 0 && off[nc] == n2 : n2 == 0;
+    for(vtkIdType i = 0; valid && i < nc; i++)
+      valid = off[i] <= off[i+1];
+    for(vtkIdType k = 0; valid && k < n2; k++)
+      valid = ids[k] >= 0 && ids[k] < n_points;
+    if(!valid)
+      throw Unsupported("invalid cells");
+
+#if VTK_MAJOR_VERSION >= 9
+    if(n1 > 0)
+      ca->SetData(offsets, conn);
+#else
+    vtkSmartPointer<vtkIdTypeArray> legacy = vtkSmartPointer<vtkIdTypeArray>::New();
+    legacy->SetNumberOfValues(nc + n2);
+    vtkIdType *p = legacy->GetPointer(0);
+    for(vtkIdType i = 0; i < nc; i++)
+      {
+      *p++ = (vtkIdType) (off[i+1] - off[i]);
+      for(vtkTypeInt64 k = off[i]; k < off[i+1]; k++)
+        *p++ = (vtkIdType) ids[k];
+      }
+    ca->SetCells(nc, legacy);
+#endif
+    return ca;
+    }
+
+  // Here n1 is the number of cells and n2 the number of values
+  vtkSmartPointer<vtkIdTypeArray> legacy = vtkSmartPointer<vtkIdTypeArray>::New();
+  legacy->SetNumberOfValues(n2);
+  ParseSection(pool, cur, n2, legacy->GetPointer(0));
+
+  const vtkIdType *p = legacy->GetPointer(0), *p_end = p + n2;
+  for(vtkIdType i = 0; i < n1; i++)
+    {
+    vtkIdType npts = p < p_end ? *p++ : -1;
+    if(npts < 0 || npts > p_end - p)
+      throw Unsupported("invalid cells");
+    for(vtkIdType k = 0; k < npts; k++, p++)
+      if(*p < 0 || *p >= n_points)
+        throw Unsupported("invalid cells");
+    }
+  if(p != p_end)
+    throw Unsupported("invalid cells");
+
+#if VTK_MAJOR_VERSION >= 9
+  ca->ImportLegacyFormat(legacy);
+#else
+  ca->SetCells(n1, legacy);
+#endif
+  return ca;
+}
+
+// Read an array of point or cell data, which becomes the active attribute
+// of its kind unless there is one already
+void ReadAttribute(ThreadPool *pool, Cursor &cur, vtkDataSetAttributes *attr, int kind,
+                   const std::string &name, const std::string &type, int nc, vtkIdType n)
+{
+  vtkSmartPointer<vtkDataArray> arr = NewArray(GetDataType(type), nc, n, DecodeName(name));
+  ParseArray(pool, cur, arr);
+  SkipMetaData(cur);
+  if(attr->GetAttribute(kind))
+    attr->AddArray(arr);
+  else
+    attr->SetAttribute(arr, kind);
+}
+
+vtkSmartPointer<vtkPolyData> ReadPolyData(ThreadPool *pool, Cursor &cur)
+{
+  // Version, title, file type and dataset type
+  if(ReadLine(cur).compare(0, 22, "# vtk DataFile Version") != 0)
+    throw Unsupported("not a legacy VTK file");
+  ReadLine(cur);
+
+  std::vector<std::string> tok = ReadTokens(cur);
+  if(tok.size() != 1 || Upper(tok[0]) != "ASCII")
+    throw Unsupported("not an ASCII file");
+
+  tok = ReadTokens(cur);
+  if(tok.size() != 2 || Upper(tok[0]) != "DATASET" || Upper(tok[1]) != "POLYDATA")
+    throw Unsupported("not a POLYDATA file");
+
+  vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+
+  // Point or cell data being read and its size
+  vtkDataSetAttributes *attr = NULL;
+  vtkIdType n_attr = 0;
+
+  while((tok = ReadTokens(cur)).size())
+    {
+    std::string key = Upper(tok[0]);
+    if(key == "POINTS" && tok.size() == 3)
+      {
+      vtkSmartPointer<vtkDataArray> arr = NewArray(GetDataType(tok[2]), 3, ToId(tok[1]), "");
+      ParseArray(pool, cur, arr);
+      SkipMetaData(cur);
+      vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+      points->SetData(arr);
+      mesh->SetPoints(points);
+      }
+    else if((key == "VERTICES" || key == "LINES" || key == "POLYGONS" || key == "TRIANGLE_STRIPS")
+            && tok.size() == 3 && !attr)
+      {
+      vtkSmartPointer<vtkCellArray> ca =
+        ReadCells(pool, cur, ToId(tok[1]), ToId(tok[2]), mesh->GetNumberOfPoints());
+      if(key == "VERTICES")
+        mesh->SetVerts(ca);
+      else if(key == "LINES")
+        mesh->SetLines(ca);
+      else if(key == "POLYGONS")
+        mesh->SetPolys(ca);
+      else
+        mesh->SetStrips(ca);
+      }
+    else if((key == "POINT_DATA" || key == "CELL_DATA") && tok.size() == 2)
+      {
+      bool point_data = key == "POINT_DATA";
+      attr = point_data ? (vtkDataSetAttributes *) mesh->GetPointData() : mesh->GetCellData();
+      n_attr = ToId(tok[1]);
+      if(n_attr != (point_data ? mesh->GetNumberOfPoints() : mesh->GetNumberOfCells()))
+        throw Unsupported(key + " does not match the size of the mesh");
+      }
+    else if(attr && key == "SCALARS" && (tok.size() == 3 || tok.size() == 4))
+      {
+      int nc = tok.size() == 4 ? (int) ToId(tok[3]) : 1;
+      std::vector<std::string> lut = ReadTokens(cur);
+      if(lut.size() != 2 || Upper(lut[0]) != "LOOKUP_TABLE")
+        throw Unsupported("SCALARS without LOOKUP_TABLE");
+      ReadAttribute(pool, cur, attr, vtkDataSetAttributes::SCALARS, tok[1], tok[2], nc, n_attr);
+      }
+    else if(attr && key == "VECTORS" && tok.size() == 3)
+      {
+      ReadAttribute(pool, cur, attr, vtkDataSetAttributes::VECTORS, tok[1], tok[2], 3, n_attr);
+      }
+    else if(attr && key == "NORMALS" && tok.size() == 3)
+      {
+      ReadAttribute(pool, cur, attr, vtkDataSetAttributes::NORMALS, tok[1], tok[2], 3, n_attr);
+      }
+    else if(attr && key == "TENSORS" && tok.size() == 3)
+      {
+      ReadAttribute(pool, cur, attr, vtkDataSetAttributes::TENSORS, tok[1], tok[2], 9, n_attr);
+      }
+    else if(attr && key == "TCOORDS" && tok.size() == 4)
+      {
+      ReadAttribute(pool, cur, attr, vtkDataSetAttributes::TCOORDS, tok[1], tok[3],
+        (int) ToId(tok[2]), n_attr);
+      }
+    else if(key == "FIELD" && tok.size() == 3)
+      {
+      // Arrays of the point or cell data, or of the mesh before any of these
+      vtkFieldData *fd = attr ? (vtkFieldData *) attr : mesh->GetFieldData();
+      vtkIdType n_arrays = ToId(tok[2]);
+      for(vtkIdType i = 0; i < n_arrays; i++)
+        {
+        std::vector<std::string> at = ReadTokens(cur);
+        if(at.size() != 4)
+          throw Unsupported("field array header");
+
+        vtkSmartPointer<vtkDataArray> arr =
+          NewArray(GetDataType(at[3]), (int) ToId(at[1]), ToId(at[2]), DecodeName(at[0]));
+        if(attr && arr->GetNumberOfTuples() != n_attr)
+          throw Unsupported("field array " + at[0] + " does not match the size of the mesh");
+        ParseArray(pool, cur, arr);
+        SkipMetaData(cur);
+        fd->AddArray(arr);
+        }
+      }
+    else
+      {
+      throw Unsupported("keyword " + tok[0]);
+      }
+    }
+
+  return mesh;
+}
+
+} // namespace
+
+using namespace ascii_polydata_reader;
+
+AsciiPolyDataReader::AsciiPolyDataReader(ThreadPool *pool)
+  : m_Pool(pool)
+{
+}
+
+vtkSmartPointer<vtkPolyData>
+AsciiPolyDataReader::Read(const std::string &fn)
+{
+  MappedFile file;
+  file.Open(fn);
+
+  m_Reason.clear();
+  try
+    {
+    Cursor cur = { file.GetData(), file.GetData() + file.GetSize() };
+    return ReadPolyData(m_Pool, cur);
+    }
+  catch(Unsupported &exc)
+    {
+    m_Reason = exc.what();
+    return NULL;
+    }
+}
@@ -0,0 +1,63 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    AsciiPolyDataReader.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __AsciiPolyDataReader_h_
+#define __AsciiPolyDataReader_h_
+
+#include <vtkSmartPointer.h>
+#include <string>
+
+class vtkPolyData;
+class ThreadPool;
+
+/**
+ * A fast reader for ASCII legacy VTK files with POLYDATA, the format that
+ * vtkPolyDataWriter writes by default. The file is mapped into memory, and
+ * each numeric section is split into chunks that are parsed in parallel
+ * with std::from_chars directly into the VTK arrays. Only the common subset
+ * of the format is handled: points, cells in the classic and the version
+ * 5.1 layout, and SCALARS, VECTORS, NORMALS, TCOORDS, TENSORS and FIELD
+ * data. For anything else, Read returns NULL and GetUnsupportedReason says
+ * why, so that the caller can fall back to vtkPolyDataReader.
+ */
+class AsciiPolyDataReader
+{
+public:
+
+  /** Create a reader, which parses on the given thread pool if not NULL */
+  AsciiPolyDataReader(ThreadPool *pool = NULL);
+
+  /** Read a mesh, or return NULL if the file is not in the supported subset */
+  vtkSmartPointer<vtkPolyData> Read(const std::string &fn);
+
+  /** Why the last file could not be read */
+  const std::string &GetUnsupportedReason() const { return m_Reason; }
+
+protected:
+
+  ThreadPool *m_Pool;
+  std::string m_Reason;
+};
+
+#endif
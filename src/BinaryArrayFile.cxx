@@ -0,0 +1,369 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    BinaryArrayFile.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "BinaryArrayFile.h"
+#include "Mesh3D.h"
+#include "ScratchStore.h"
+#include <vtkDataArray.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+
+namespace binary_array_file {
+
+// Numeric types of NumPy, by name and by kind (float, signed and unsigned
+// integer) and size, as in the dtype descriptor '<f4'
+struct NumpyType
+{
+  const char *name;
+  char kind;
+  int size;
+  int vtk_type;
+};
+
+const NumpyType NumpyTypes[] = {
+  { "float32", 'f', 4, VTK_FLOAT },
+  { "float64", 'f', 8, VTK_DOUBLE },
+  { "int8", 'i', 1, VTK_SIGNED_CHAR },
+  { "uint8", 'u', 1, VTK_UNSIGNED_CHAR },
+  { "int16", 'i', 2, VTK_SHORT },
+  { "uint16", 'u', 2, VTK_UNSIGNED_SHORT },
+  { "int32", 'i', 4, VTK_INT },
+  { "uint32", 'u', 4, VTK_UNSIGNED_INT },
+  { "int64", 'i', 8, VTK_LONG_LONG },
+  { "uint64", 'u', 8, VTK_UNSIGNED_LONG_LONG },
+  { "bool", 'b', 1, VTK_UNSIGNED_CHAR } };
+
+const int NumNumpyTypes = sizeof(NumpyTypes) / sizeof(NumpyType);
+
+bool IsLittleEndian()
+{
+  uint16_t x = 1;
+  return *(const char *) &x == 1;
+}
+
+// Kind of the values of a VTK array in NumPy terms, or 0 if not numeric
+char GetKind(int vtk_type)
+{
+  switch(vtk_type)
+    {
+    case VTK_FLOAT:
+    case VTK_DOUBLE:
+      return 'f';
+    case VTK_CHAR:
+    case VTK_SIGNED_CHAR:
+    case VTK_SHORT:
+    case VTK_INT:
+    case VTK_LONG:
+    case VTK_LONG_LONG:
+    case VTK_ID_TYPE:
+      return 'i';
+    case VTK_UNSIGNED_CHAR:
+    case VTK_UNSIGNED_SHORT:
+    case VTK_UNSIGNED_INT:
+    case VTK_UNSIGNED_LONG:
+    case VTK_UNSIGNED_LONG_LONG:
+      return 'u';
+    default:
+      return 0;
+    }
+}
+
+// Reverse the bytes of each of n values of the given size
+void SwapBytes(char *p, vtkIdType n, int size)
+{
+  for(vtkIdType i = 0; i < n; i++, p += size)
+    std::reverse(p, p + size);
+}
+
+// Find the value of a key in the header dictionary of a .npy file
+std::string GetHeaderValue(const std::string &header, const std::string &key,
+                           const std::string &fn)
+{
+  size_t pos = header.find("'" + key + "'");
+  if(pos == std::string::npos)
+    throw MeshException("No %s in the header of %s", key.c_str(), fn.c_str());
+  pos = header.find(':', pos);
+  size_t start = header.find_first_not_of(" ", pos + 1);
+  if(pos == std::string::npos || start == std::string::npos)
+    throw MeshException("Invalid header in %s", fn.c_str());
+
+  // The value is a string, a tuple or a word
+  size_t stop;
+  if(header[start] == '\'')
+    stop = header.find('\'', start + 1) + 1;
+  else if(header[start] == '(')
+    stop = header.find(')', start) + 1;
+  else
+    stop = header.find_first_of(",}", start);
+  if(stop == std::string::npos || stop == 0)
+    throw MeshException("Invalid header in %s", fn.c_str());
+  return header.substr(start, stop - start);
+}
+
+std::ofstream OpenOutput(const std::string &fn)
+{
+  std::ofstream os(fn.c_str(), std::ios::binary);
+  if(!os)
+    throw MeshException("Unable to open %s for writing", fn.c_str());
+  return os;
+}
+
+// Check that an array can be written as raw values
+void CheckArray(vtkDataArray *arr, const std::string &fn)
+{
+  if(!GetKind(arr->GetDataType()))
+    throw MeshException("Array %s of type %s cannot be written to %s",
+      arr->GetName() ? arr->GetName() : "", arr->GetDataTypeAsString(), fn.c_str());
+}
+
+// New array in the scratch store if there is one, otherwise in memory
+vtkSmartPointer<vtkDataArray> NewArray(const ScratchStore *store, int vtk_type, int nc, vtkIdType nt)
+{
+  if(store)
+    return store->NewArray(vtk_type, nc, nt);
+
+  vtkSmartPointer<vtkDataArray> arr;
+  arr.TakeReference(vtkDataArray::CreateDataArray(vtk_type));
+  arr->SetNumberOfComponents(nc);
+  arr->SetNumberOfTuples(nt);
+  return arr;
+}
+
+// Read the values of an array stored one tuple after another, in chunks
+// that fit the memory budget of the store
+void ReadTuples(std::istream &is, vtkDataArray *arr, bool swap,
+                const ScratchStore *store, const std::string &fn)
+{
+  vtkIdType nt = arr->GetNumberOfTuples();
+  int size = arr->GetDataTypeSize(), nc = arr->GetNumberOfComponents();
+  size_t tuple_size = (size_t) nc * size;
+  vtkIdType chunk = store ? store->GetChunkSize(nt, tuple_size) : nt;
+  char *data = (char *) arr->GetVoidPointer(0);
+  for(vtkIdType i0 = 0; i0 < nt; i0 += chunk)
+    {
+    vtkIdType i1 = std::min(nt, i0 + chunk);
+    char *p = data + i0 * tuple_size;
+    if(!is.read(p, (std::streamsize) ((i1 - i0) * tuple_size)))
+      throw MeshException("File %s is truncated", fn.c_str());
+    if(swap)
+      SwapBytes(p, (i1 - i0) * nc, size);
+    ScratchStore::Release(arr, i0, i1);
+    }
+}
+
+// Read the values of an array stored one component after another, which
+// are interleaved into tuples a chunk at a time
+void ReadComponents(std::istream &is, vtkDataArray *arr, bool swap,
+                    const ScratchStore *store, const std::string &fn)
+{
+  vtkIdType nt = arr->GetNumberOfTuples();
+  int size = arr->GetDataTypeSize(), nc = arr->GetNumberOfComponents();
+  vtkIdType chunk = store ? store->GetChunkSize(nt, 2 * nc * size) : nt;
+  std::streamoff start = is.tellg();
+  std::vector<char> column;
+  char *data = (char *) arr->GetVoidPointer(0);
+  for(vtkIdType i0 = 0; i0 < nt; i0 += chunk)
+    {
+    vtkIdType i1 = std::min(nt, i0 + chunk);
+    column.resize((i1 - i0) * size);
+    for(int c = 0; c < nc; c++)
+      {
+      is.seekg(start + (std::streamoff) (c * nt + i0) * size);
+      if(!is.read(column.data(), (std::streamsize) column.size()))
+        throw MeshException("File %s is truncated", fn.c_str());
+      if(swap)
+        SwapBytes(column.data(), i1 - i0, size);
+      for(vtkIdType i = i0; i < i1; i++)
+        memcpy(data + (i * nc + c) * size, column.data() + (i - i0) * size, size);
+      }
+    ScratchStore::Release(arr, i0, i1);
+    }
+}
+
+// Write the values of an array in chunks that fit the memory budget
+void WriteTuples(std::ostream &os, vtkDataArray *arr, const ScratchStore *store,
+                 const std::string &fn)
+{
+  vtkIdType nt = arr->GetNumberOfTuples();
+  size_t tuple_size = (size_t) arr->GetNumberOfComponents() * arr->GetDataTypeSize();
+  vtkIdType chunk = store ? store->GetChunkSize(nt, tuple_size) : nt;
+  const char *data = (const char *) arr->GetVoidPointer(0);
+  for(vtkIdType i0 = 0; i0 < nt; i0 += chunk)
+    {
+    vtkIdType i1 = std::min(nt, i0 + chunk);
+    os.write(data + i0 * tuple_size, (std::streamsize) ((i1 - i0) * tuple_size));
+    ScratchStore::Release(arr, i0, i1);
+    }
+  if(!os)
+    throw MeshException("Error writing array to %s", fn.c_str());
+}
+
+} // namespace
+
+using namespace binary_array_file;
+
+int
+BinaryArrayFile::GetDataType(const std::string &dtype)
+{
+  for(int t = 0; t < NumNumpyTypes; t++)
+    if(dtype == NumpyTypes[t].name)
+      return NumpyTypes[t].vtk_type;
+  if(dtype == "float")
+    return VTK_FLOAT;
+  if(dtype == "double")
+    return VTK_DOUBLE;
+  return -1;
+}
+
+vtkSmartPointer<vtkDataArray>
+BinaryArrayFile::ReadNumpy(const std::string &fn, const ScratchStore *store)
+{
+  std::ifstream is(fn.c_str(), std::ios::binary);
+  if(!is)
+    throw MeshException("Unable to open %s", fn.c_str());
+
+  // Magic string, version and header length, which has 4 bytes from
+  // version 2 on
+  unsigned char pre[10];
+  if(!is.read((char *) pre, 8) || memcmp(pre, "\x93NUMPY", 6) != 0)
+    throw MeshException("File %s is not a .npy file", fn.c_str());
+  uint32_t header_len = 0;
+  if(pre[6] == 1)
+    {
+    is.read((char *) pre + 8, 2);
+    header_len = pre[8] | (pre[9] << 8);
+    }
+  else
+    {
+    unsigned char len[4];
+    is.read((char *) len, 4);
+    header_len = len[0] | (len[1] << 8) | (len[2] << 16) | ((uint32_t) len[3] << 24);
+    }
+
+  std::string header(header_len, ' ');
+  if(!is.read(&header[0], header_len))
+    throw MeshException("File %s is truncated", fn.c_str());
+
+  // The dtype descriptor, e.g. '<f4', gives the byte order, kind and size
+  std::string descr = GetHeaderValue(header, "descr", fn);
+  if(descr.size() < 5)
+    throw MeshException("Unsupported dtype %s in %s", descr.c_str(), fn.c_str());
+  char order = descr[1], kind = descr[2];
+  int size = atoi(descr.substr(3, descr.size() - 4).c_str());
+  int vtk_type = -1;
+  for(int t = 0; t < NumNumpyTypes && vtk_type < 0; t++)
+    if(NumpyTypes[t].kind == kind && NumpyTypes[t].size == size)
+      vtk_type = NumpyTypes[t].vtk_type;
+  if(vtk_type < 0)
+    throw MeshException("Unsupported dtype %s in %s", descr.c_str(), fn.c_str());
+  bool swap = size > 1 && (order == '<' ? !IsLittleEndian() : order == '>' ? IsLittleEndian() : false);
+
+  bool fortran = GetHeaderValue(header, "fortran_order", fn) == "True";
+
+  // Shape (n,) or (n, k)
+  std::string shape = GetHeaderValue(header, "shape", fn);
+  std::replace(shape.begin(), shape.end(), ',', ' ');
+  std::istringstream iss(shape.substr(1, shape.size() - 2));
+  std::vector<long long> dims;
+  long long d;
+  while(iss >> d)
+    dims.push_back(d);
+  if(dims.size() < 1 || dims.size() > 2)
+    throw MeshException("Array in %s has shape %s, expected (n,) or (n, k)", fn.c_str(), shape.c_str());
+  vtkIdType nt = dims[0];
+  int nc = dims.size() > 1 ? (int) dims[1] : 1;
+  if(nc < 1)
+    throw MeshException("Array in %s has no columns", fn.c_str());
+
+  // The values are read straight into the array, with columns stored one
+  // after another interleaved into tuples
+  vtkSmartPointer<vtkDataArray> arr = NewArray(store, vtk_type, nc, nt);
+  if(fortran && nc > 1)
+    ReadComponents(is, arr, swap, store, fn);
+  else
+    ReadTuples(is, arr, swap, store, fn);
+
+  return arr;
+}
+
+void
+BinaryArrayFile::WriteNumpy(vtkDataArray *arr, const std::string &fn, const ScratchStore *store)
+{
+  CheckArray(arr, fn);
+
+  // Header dictionary, padded with spaces so that the data starts at a
+  // multiple of 64 bytes
+  int size = arr->GetDataTypeSize();
+  std::ostringstream dict;
+  dict << "{'descr': '" << (size == 1 ? '|' : IsLittleEndian() ? '<' : '>')
+       << GetKind(arr->GetDataType()) << size << "', 'fortran_order': False, 'shape': ("
+       << (long long) arr->GetNumberOfTuples();
+  if(arr->GetNumberOfComponents() > 1)
+    dict << ", " << arr->GetNumberOfComponents() << "), }";
+  else
+    dict << ",), }";
+
+  std::string header = dict.str();
+  size_t total = 10 + header.size() + 1;
+  header.append((64 - total % 64) % 64, ' ');
+  header.push_back('\n');
+
+  std::ofstream os = OpenOutput(fn);
+  unsigned char pre[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+    (unsigned char) (header.size() & 0xff), (unsigned char) (header.size() >> 8) };
+  os.write((const char *) pre, 10);
+  os << header;
+  WriteTuples(os, arr, store, fn);
+}
+
+vtkSmartPointer<vtkDataArray>
+BinaryArrayFile::ReadRaw(const std::string &fn, int vtk_type, int nc, const ScratchStore *store)
+{
+  std::ifstream is(fn.c_str(), std::ios::binary | std::ios::ate);
+  if(!is)
+    throw MeshException("Unable to open %s", fn.c_str());
+
+  // The number of tuples follows from the size of the file
+  std::streamsize bytes = is.tellg();
+  std::streamsize tuple_size = (std::streamsize) nc * vtkAbstractArray::GetDataTypeSize(vtk_type);
+  if(nc < 1 || bytes % tuple_size != 0)
+    throw MeshException("Size of %s (%ld bytes) is not a multiple of the tuple size (%ld bytes)",
+      fn.c_str(), (long) bytes, (long) tuple_size);
+
+  vtkSmartPointer<vtkDataArray> arr = NewArray(store, vtk_type, nc, bytes / tuple_size);
+  is.seekg(0);
+  ReadTuples(is, arr, false, store, fn);
+  return arr;
+}
+
+void
+BinaryArrayFile::WriteRaw(vtkDataArray *arr, const std::string &fn, const ScratchStore *store)
+{
+  CheckArray(arr, fn);
+  std::ofstream os = OpenOutput(fn);
+  WriteTuples(os, arr, store, fn);
+}
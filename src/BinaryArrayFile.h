@@ -0,0 +1,73 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    BinaryArrayFile.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __BinaryArrayFile_h_
+#define __BinaryArrayFile_h_
+
+#include <vtkSmartPointer.h>
+#include <string>
+
+class vtkDataArray;
+class ScratchStore;
+
+/**
+ * Reading and writing of data arrays as NumPy .npy files and as raw binary
+ * files. The values are moved between the file and the array buffer in a
+ * single read or write, in the type of the array, without any conversion.
+ * A .npy file holds one tuple per row, with shape (n,) or (n, k). Raw files
+ * hold the tuples one after another in the byte order of the machine.
+ * Given a ScratchStore, new arrays are created in it and the values are
+ * moved in chunks that fit its memory budget.
+ */
+class BinaryArrayFile
+{
+public:
+
+  /** Read a .npy file into a new array of the matching type */
+  static vtkSmartPointer<vtkDataArray> ReadNumpy(const std::string &fn,
+                                                 const ScratchStore *store = NULL);
+
+  /** Write an array as a .npy file */
+  static void WriteNumpy(vtkDataArray *arr, const std::string &fn,
+                         const ScratchStore *store = NULL);
+
+  /**
+   * Read a raw file into a new array of the given VTK type with nc
+   * components. The number of tuples is given by the size of the file
+   */
+  static vtkSmartPointer<vtkDataArray> ReadRaw(const std::string &fn, int vtk_type, int nc,
+                                               const ScratchStore *store = NULL);
+
+  /** Write the values of an array as a raw file */
+  static void WriteRaw(vtkDataArray *arr, const std::string &fn,
+                       const ScratchStore *store = NULL);
+
+  /**
+   * VTK type of a NumPy dtype name, such as float32 or uint8, or -1 if
+   * the name is not a known type
+   */
+  static int GetDataType(const std::string &dtype);
+};
+
+#endif
@@ -38,7 +38,7 @@ void CommandAdapter::Info(const char *format,...)
   char buffer[4096];
   va_list args;
   va_start (args, format);
-  vsprintf (buffer,format, args);
+  vsnprintf (buffer, sizeof(buffer), format, args);
   va_end (args);
 
   c->Info(buffer);
@@ -49,7 +49,7 @@ void CommandAdapter::Debug(const char *format,...)
   char buffer[4096];
   va_list args;
   va_start (args, format);
-  vsprintf (buffer,format, args);
+  vsnprintf (buffer, sizeof(buffer), format, args);
   va_end (args);
 
   c->Debug(buffer);
@@ -60,10 +60,10 @@ void CommandAdapter::ThrowException(const char *format,...)
   char buffer[4096];
   va_list args;
   va_start (args, format);
-  vsprintf (buffer,format, args);
+  vsnprintf (buffer, sizeof(buffer), format, args);
   va_end (args);
 
-  throw MeshException(buffer);
+  throw MeshException("%s", buffer);
 }
 
 int CommandAdapter::GetDataArraySize(PolyDataType *mesh)
@@ -55,12 +55,29 @@ protected:
   // Methods available to every adapter
   void Debug(const char *format,...);
   void Info(const char *format,...);
-  void ThrowException(const char *format,...);
+  [[noreturn]] void ThrowException(const char *format,...);
+
+  // Run the action of a command now, or when the plan of a script is run.
+  // Parse checks the arguments and gives the action everything it needs
+  void Schedule(const std::function<void()> &action) { c->Schedule(action); }
 
   // Direct access to the push/pull methods from the converter
   PolyDataPointer TopPolyData() { return c->TopPolyData(); }
   PolyDataPointer PopPolyData() { return c->PopPolyData(); }
   void Push(PolyDataType *pd);
+  void PushCached(const std::shared_ptr<MeshCacheEntry> &entry) { c->PushCached(entry); }
+
+  // Cached topology of the mesh at the top of the stack
+  MeshTopology *TopTopology() { return c->TopTopology(); }
+
+  // Worker threads shared by all adapters
+  ThreadPool *GetThreadPool() { return c->GetThreadPool(); }
+
+  // Storage for large arrays and the memory budget for processing them
+  ScratchStore *GetScratchStore() { return c->GetScratchStore(); }
+
+  // Meshes kept by the server between requests, NULL outside of the server
+  MeshCache *GetMeshCache() { return c->GetMeshCache(); }
 
   // Data array access based on current mode
   DataArrayPointer GetDataArray(PolyDataType *mesh, const string &array, bool throw_if_missing = true);
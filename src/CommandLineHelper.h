@@ -29,6 +29,7 @@
 
 #include <cerrno>
 #include <iostream>
+#include <set>
 #include <sstream>
 #include "vtksys/SystemTools.hxx"
 
@@ -45,7 +46,7 @@ public:
     buffer = new char[4096];
     va_list args;
     va_start (args, format);
-    vsprintf (buffer,format, args);
+    vsnprintf (buffer, 4096, format, args);
     va_end (args);
     }
 
@@ -77,6 +78,14 @@ public:
     return i >= argc;
   }
 
+  /**
+   * Index of the next argument
+   */
+  int get_position() const
+  {
+    return i;
+  }
+
   /**
    * Just read the next arg (used internally)
    */
@@ -171,17 +180,45 @@ public:
   }
 
   /**
-   * Read an existing filename
+   * Read an existing filename. Files given as outputs earlier on the command
+   * line also count, since they are written before this one is read
    */
   std::string read_existing_filename()
   {
     std::string file = read_arg();
-    if(!vtksys::SystemTools::FileExists(file.c_str()))
+    if(!vtksys::SystemTools::FileExists(file.c_str()) && !output_files.count(file)
+       && (deferred_marker.empty() || file.find(deferred_marker) == std::string::npos))
       throw CommandLineException("File '%s' does not exist", file.c_str());
 
     return file;
   }
 
+  /**
+   * Files given as outputs so far
+   */
+  const std::set<std::string> &get_output_files() const
+  {
+    return output_files;
+  }
+
+  /**
+   * Add output files of commands parsed by another helper, such as the one
+   * of an enclosing script, so that they count as existing here too
+   */
+  void add_output_files(const std::set<std::string> &files)
+  {
+    output_files.insert(files.begin(), files.end());
+  }
+
+  /**
+   * File names that contain the marker are taken to exist. This is used to
+   * check commands whose file names are only known when they run
+   */
+  void set_deferred_file_marker(const std::string &marker)
+  {
+    deferred_marker = marker;
+  }
+
   /**
    * Read a transform specification, format file,number
    */
@@ -220,6 +257,7 @@ public:
   std::string read_output_filename()
   {
     std::string file = read_arg();
+    output_files.insert(file);
     return file;
   }
 
@@ -376,6 +414,8 @@ private:
   int argc, i;
   char **argv;
   std::string current_command;
+  std::set<std::string> output_files;
+  std::string deferred_marker;
 };
 
 #endif // COMMANDLINEHELPER_H
@@ -0,0 +1,162 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    CommandPlan.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "CommandPlan.h"
+#include "Mesh3D.h"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace command_plan {
+
+// Length of a line continuation at position p of the text, i.e. a backslash
+// at the end of a line with Unix or Windows line endings, or zero
+size_t GetContinuationLength(const std::string &text, size_t p)
+{
+  if(text.compare(p, 2, "\\\n") == 0)
+    return 2;
+  if(text.compare(p, 3, "\\\r\n") == 0)
+    return 3;
+  return 0;
+}
+
+} // namespace
+
+using namespace command_plan;
+
+void
+CommandPlan::Add(const std::string &label, const Action &action)
+{
+  Step step;
+  step.label = label;
+  step.action = action;
+  m_Steps.push_back(step);
+}
+
+void
+CommandPlan::Run() const
+{
+  for(size_t i = 0; i < m_Steps.size(); i++)
+    {
+    try
+      {
+      m_Steps[i].action();
+      }
+    catch(std::exception &exc)
+      {
+      std::ostringstream context;
+      context << "Step " << i + 1 << " of " << m_Steps.size()
+              << " (" << m_Steps[i].label << ") failed";
+      throw MeshException("%s", FormatError(context.str(), exc.what()).c_str());
+      }
+    }
+}
+
+std::string
+CommandPlan::FormatError(const std::string &context, const std::string &error)
+{
+  const size_t max_length = MeshException::BufferSize - 1;
+  const std::string ellipsis = "...";
+  std::string head = context + ": ";
+  if(head.size() + error.size() <= max_length)
+    return head + error;
+
+  // Keep at most half of the space for the context
+  if(head.size() > max_length / 2)
+    head = context.substr(0, max_length / 2 - ellipsis.size() - 2) + ellipsis + ": ";
+  size_t tail = max_length - head.size() - ellipsis.size();
+  return head + ellipsis + error.substr(error.size() - tail);
+}
+
+void
+CommandPlan::ReadScript(const std::string &fn, std::vector<std::string> &args,
+                        std::vector<int> &lines)
+{
+  std::ifstream fs(fn.c_str(), std::ios::binary);
+  if(!fs)
+    throw MeshException("Unable to read script %s", fn.c_str());
+  std::string text((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+
+  int line = 1;
+  size_t p = 0, n = text.size();
+  while(p < n)
+    {
+    // Skip white space and comments
+    char ch = text[p];
+    if(ch == '\n' || ch == ' ' || ch == '\t' || ch == '\r')
+      {
+      line += (ch == '\n');
+      p++;
+      continue;
+      }
+    if(size_t k = GetContinuationLength(text, p))
+      {
+      // A backslash at the end of a line continues the command
+      line++;
+      p += k;
+      continue;
+      }
+    if(ch == '#')
+      {
+      while(p < n && text[p] != '\n')
+        p++;
+      continue;
+      }
+
+    // Read an argument up to unquoted white space
+    std::string arg;
+    int start_line = line;
+    char quote = 0;
+    for(; p < n; p++)
+      {
+      ch = text[p];
+      if(quote)
+        {
+        if(ch == quote)
+          quote = 0;
+        else if(ch == '\\' && quote == '"' && p + 1 < n)
+          arg += text[++p];
+        else
+          arg += ch;
+        }
+      else if(ch == '\'' || ch == '"')
+        quote = ch;
+      else if(GetContinuationLength(text, p))
+        break;
+      else if(ch == '\\' && p + 1 < n)
+        arg += text[++p];
+      else if(ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n')
+        break;
+      else
+        arg += ch;
+      if(text[p] == '\n')
+        line++;
+      }
+
+    if(quote)
+      throw MeshException("Unterminated quote in script %s, line %d", fn.c_str(), start_line);
+    args.push_back(arg);
+    lines.push_back(start_line);
+    }
+}
@@ -0,0 +1,90 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    CommandPlan.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __CommandPlan_h_
+#define __CommandPlan_h_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * A list of commands parsed from a script, to be run later. The adapters
+ * parse and check their arguments up front, and add an action that runs
+ * the command with them. So a whole script is checked before any work
+ * starts. The actions keep the arguments as they were parsed, so a plan
+ * can not be given other file names; -foreach parses its pipeline again
+ * for each item.
+ */
+class CommandPlan
+{
+public:
+
+  typedef std::function<void()> Action;
+
+  /** Add a step, with a label such as the command and its script line */
+  void Add(const std::string &label, const Action &action);
+
+  /** Number of steps */
+  size_t GetNumberOfSteps() const { return m_Steps.size(); }
+
+  /** Label of a step */
+  const std::string &GetLabel(size_t i) const { return m_Steps[i].label; }
+
+  /**
+   * Run the steps in order. A MeshException for a failed step tells which
+   * step it was
+   */
+  void Run() const;
+
+  /**
+   * Split the text of a script file into arguments, which are separated by
+   * white space, can be quoted with ' or ", and can contain characters
+   * escaped with a backslash outside of single quotes. A # at the start of
+   * an argument comments out the rest of the line. Also gives the line on
+   * which each argument starts
+   */
+  static void ReadScript(const std::string &fn, std::vector<std::string> &args,
+                         std::vector<int> &lines);
+
+  /**
+   * The message for an error in a step or script, "context: error". Errors
+   * are wrapped once per level of nested scripts, so the middle of a long
+   * message is left out to fit a MeshException, keeping the start of the
+   * context and the end of the error, which says what went wrong
+   */
+  static std::string FormatError(const std::string &context, const std::string &error);
+
+protected:
+
+  struct Step
+  {
+    std::string label;
+    Action action;
+  };
+
+  std::vector<Step> m_Steps;
+};
+
+#endif
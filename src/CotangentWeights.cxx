@@ -0,0 +1,168 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    CotangentWeights.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "CotangentWeights.h"
+#include "Mesh3D.h"
+#include <vtkPolyData.h>
+#include <vtkIdList.h>
+#include <vtkMath.h>
+#include <vtkSmartPointer.h>
+#include <algorithm>
+#include <cmath>
+
+namespace cotangent_weights {
+
+// Edges of triangles and tetras, in the same order as in MeshAdjacency
+const int TriangleEdges[3][2] = { {0,1}, {1,2}, {0,2} };
+const int TetraEdges[6][2] = { {0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3} };
+
+// Vertex of a triangle opposite to each of its edges
+const int TriangleOpposite[3] = { 2, 0, 1 };
+
+// Position of the entry for neighbor j in the row of node i. The rows of
+// the adjacency are sorted, so this is a binary search
+vtkIdType FindEntry(const MeshAdjacency &adj, vtkIdType i, vtkIdType j)
+{
+  const MeshAdjacency::IndexType *nbr = adj.GetNeighbors();
+  const MeshAdjacency::IndexType *row = nbr + adj.GetOffsets()[i], *row_end = nbr + adj.GetOffsets()[i+1];
+  const MeshAdjacency::IndexType *it = std::lower_bound(row, row_end, (MeshAdjacency::IndexType) j);
+  if(it == row_end || *it != j)
+    throw MeshException("Edge %ld-%ld is missing from the adjacency graph", (long) i, (long) j);
+  return it - nbr;
+}
+
+// Edge weights of a triangle, returns its area. The cotangent of the angle
+// between u and v is u.v / |u x v|, degenerate angles get zero weight
+double TriangleWeights(const double x[4][3], double w[6])
+{
+  double u[3], v[3], c[3];
+  for(int e = 0; e < 3; e++)
+    {
+    const double *xo = x[TriangleOpposite[e]];
+    vtkMath::Subtract(x[TriangleEdges[e][0]], xo, u);
+    vtkMath::Subtract(x[TriangleEdges[e][1]], xo, v);
+    vtkMath::Cross(u, v, c);
+    double sin_uv = vtkMath::Norm(c);
+    w[e] = sin_uv > 0.0 ? 0.5 * vtkMath::Dot(u, v) / sin_uv : 0.0;
+    }
+
+  vtkMath::Subtract(x[1], x[0], u);
+  vtkMath::Subtract(x[2], x[0], v);
+  vtkMath::Cross(u, v, c);
+  return 0.5 * vtkMath::Norm(c);
+}
+
+// Edge weights of a tetra, returns its volume. The gradients of the
+// barycentric coordinates of vertices 1-3 are the columns of the inverse of
+// the matrix with rows e_r = x_r - x_0, i.e., (e2 x e3) / det and so on
+double TetraWeights(const double x[4][3], double w[6])
+{
+  double e[3][3], g[4][3];
+  for(int r = 0; r < 3; r++)
+    vtkMath::Subtract(x[r+1], x[0], e[r]);
+
+  vtkMath::Cross(e[1], e[2], g[1]);
+  vtkMath::Cross(e[2], e[0], g[2]);
+  vtkMath::Cross(e[0], e[1], g[3]);
+  double det = vtkMath::Dot(e[0], g[1]);
+  if(det == 0.0)
+    {
+    std::fill(w, w + 6, 0.0);
+    return 0.0;
+    }
+
+  for(int d = 0; d < 3; d++)
+    {
+    g[1][d] /= det; g[2][d] /= det; g[3][d] /= det;
+    g[0][d] = -(g[1][d] + g[2][d] + g[3][d]);
+    }
+
+  // The weight is minus the entry V grad(phi_a) . grad(phi_b) of the
+  // element stiffness matrix
+  double vol = std::fabs(det) / 6.0;
+  for(int k = 0; k < 6; k++)
+    w[k] = -vol * vtkMath::Dot(g[TetraEdges[k][0]], g[TetraEdges[k][1]]);
+  return vol;
+}
+
+} // namespace
+
+using namespace cotangent_weights;
+
+void
+CotangentWeights::Clear()
+{
+  m_Weights.clear();
+  m_Diagonal.clear();
+  m_Mass.clear();
+}
+
+size_t
+CotangentWeights::GetMemorySize() const
+{
+  return (m_Weights.capacity() + m_Diagonal.capacity() + m_Mass.capacity()) * sizeof(double);
+}
+
+void
+CotangentWeights::Compute(vtkPolyData *mesh, const MeshAdjacency &adj)
+{
+  vtkIdType n = adj.GetNumberOfNodes();
+  if(mesh->GetNumberOfPoints() != n)
+    throw MeshException("Mesh has %ld vertices but the adjacency graph has %ld nodes",
+      (long) mesh->GetNumberOfPoints(), (long) n);
+
+  m_Weights.assign(adj.GetOffsets()[n], 0.0);
+  m_Diagonal.assign(n, 0.0);
+  m_Mass.assign(n, 0.0);
+
+  // Add up the contributions of the cells to their edges and vertices
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  double x[4][3], w[6];
+  for(vtkIdType i = 0; i < mesh->GetNumberOfCells(); i++)
+    {
+    int type = mesh->GetCellType(i);
+    if(type != VTK_TRIANGLE && type != VTK_TETRA)
+      throw MeshException("Wrong cell type for diffusion, must be triangle or tetra");
+
+    mesh->GetCellPoints(i, ids);
+    vtkIdType *p = ids->GetPointer(0);
+    int nv = type == VTK_TRIANGLE ? 3 : 4, ne = type == VTK_TRIANGLE ? 3 : 6;
+    const int (*table)[2] = type == VTK_TRIANGLE ? TriangleEdges : TetraEdges;
+    for(int v = 0; v < nv; v++)
+      mesh->GetPoint(p[v], x[v]);
+
+    double size = type == VTK_TRIANGLE ? TriangleWeights(x, w) : TetraWeights(x, w);
+    for(int v = 0; v < nv; v++)
+      m_Mass[p[v]] += size / nv;
+
+    for(int e = 0; e < ne; e++)
+      {
+      vtkIdType a = p[table[e][0]], b = p[table[e][1]];
+      m_Weights[FindEntry(adj, a, b)] += w[e];
+      m_Weights[FindEntry(adj, b, a)] += w[e];
+      m_Diagonal[a] += w[e];
+      m_Diagonal[b] += w[e];
+      }
+    }
+}
@@ -0,0 +1,74 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    CotangentWeights.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __CotangentWeights_h_
+#define __CotangentWeights_h_
+
+#include "MeshAdjacency.h"
+#include <vtkType.h>
+#include <vector>
+
+class vtkPolyData;
+
+/**
+ * Edge weights and lumped mass of the linear finite element Laplacian of a
+ * triangle or tetra mesh. For triangles the weight of edge (i,j) is half
+ * the sum of the cotangents of the angles opposite to it, for tetras it is
+ * the negated entry of the element stiffness matrix, which is the sum of
+ * l cot(theta) / 6 over the opposite edges of length l and dihedral angle
+ * theta. The mass of a vertex is a third of the area of its triangles or a
+ * quarter of the volume of its tetras. The weights are stored in a flat
+ * array aligned with the neighbors of a vertex MeshAdjacency, so they can
+ * be read in the same sweep as the graph.
+ */
+class CotangentWeights
+{
+public:
+
+  CotangentWeights() {}
+
+  /** Compute the weights of the edges of adj from the geometry of the mesh */
+  void Compute(vtkPolyData *mesh, const MeshAdjacency &adj);
+
+  /** Empty the tables */
+  void Clear();
+
+  /** Weight of each entry of adj.GetNeighbors() */
+  const double *GetWeights() const { return m_Weights.data(); }
+
+  /** Sum of the weights of the edges of each vertex */
+  const double *GetDiagonal() const { return m_Diagonal.data(); }
+
+  /** Lumped mass of each vertex, zero for vertices not in any cell */
+  const double *GetMass() const { return m_Mass.data(); }
+
+  /** Memory used by the tables, in bytes */
+  size_t GetMemorySize() const;
+
+protected:
+
+  std::vector<double> m_Weights, m_Diagonal, m_Mass;
+};
+
+#endif
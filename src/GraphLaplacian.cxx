@@ -0,0 +1,468 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    GraphLaplacian.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "GraphLaplacian.h"
+#include "CotangentWeights.h"
+#include "MeshAdjacency.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+// The arrays that define the operator L = M^-1 K. Without weights, each edge
+// has unit weight and the diagonal of K is the degree of the node
+struct GraphLaplacian::Operator
+{
+  const vtkIdType *offset;
+  const MeshAdjacency::IndexType *nbr;
+  const double *weight, *diag, *inv_mass, *mass;
+
+  double Diagonal(vtkIdType i) const
+    { return diag ? diag[i] : (double) (offset[i+1] - offset[i]); }
+};
+
+namespace graph_laplacian {
+
+// Number of blocks for parallel reductions
+const int ReductionBlocks = 64;
+
+typedef GraphLaplacian::Operator Operator;
+
+// The kernels below are templated on the number of components, so that for
+// the common cases the component loops have a fixed trip count and can be
+// unrolled and vectorized. NC = 0 is the fallback for any number of
+// components, passed at runtime in nc_rt.
+
+// Weighted sum of the values of the neighbors of node i
+template <int NC, class TValue, class TAccum>
+inline void NeighborSum(const Operator &op, vtkIdType i, int nc, const TValue *f, TAccum *sum)
+{
+  for(int j = 0; j < nc; j++)
+    sum[j] = 0;
+
+  if(op.weight)
+    {
+    for(vtkIdType k = op.offset[i]; k < op.offset[i+1]; k++)
+      {
+      const TValue *fk = f + (vtkIdType) op.nbr[k] * nc;
+      TAccum w = (TAccum) op.weight[k];
+      for(int j = 0; j < nc; j++)
+        sum[j] += w * fk[j];
+      }
+    }
+  else
+    {
+    for(vtkIdType k = op.offset[i]; k < op.offset[i+1]; k++)
+      {
+      const TValue *fk = f + (vtkIdType) op.nbr[k] * nc;
+      for(int j = 0; j < nc; j++)
+        sum[j] += fk[j];
+      }
+    }
+}
+
+// Explicit Euler step over the rows [begin, end), for data stored as TValue
+// with neighbor sums accumulated as TAccum
+template <class TValue, class TAccum>
+struct ExplicitStepKernel
+{
+  template <int NC>
+  static void Run(const Operator &op, double dt, int nc_rt,
+                  const TValue * __restrict f, TValue * __restrict f_out,
+                  vtkIdType begin, vtkIdType end)
+  {
+    const int nc = NC > 0 ? NC : nc_rt;
+    TAccum sum_buf[NC > 0 ? NC : 1];
+    std::vector<TAccum> sum_vec(NC > 0 ? 0 : nc);
+    TAccum *sum = NC > 0 ? sum_buf : sum_vec.data();
+
+    for(vtkIdType i = begin; i < end; i++)
+      {
+      const TValue *fi = f + i * nc;
+      NeighborSum<NC>(op, i, nc, f, sum);
+
+      // f_i + dt / m_i * Sum_j w_ij (f_j - f_i)
+      TAccum w = (TAccum) (dt * op.inv_mass[i]), d = (TAccum) op.Diagonal(i);
+      TValue *fo = f_out + i * nc;
+      for(int j = 0; j < nc; j++)
+        fo[j] = (TValue) (fi[j] + w * (sum[j] - d * fi[j]));
+      }
+  }
+};
+
+// Product with the implicit system matrix M + dt K over the rows [begin, end)
+template <int NC>
+void MultiplyImplicitKernel(const Operator &op, double dt, int nc_rt,
+                            const double * __restrict x, double * __restrict y,
+                            vtkIdType begin, vtkIdType end)
+{
+  const int nc = NC > 0 ? NC : nc_rt;
+  double sum_buf[NC > 0 ? NC : 1];
+  std::vector<double> sum_vec(NC > 0 ? 0 : nc);
+  double *sum = NC > 0 ? sum_buf : sum_vec.data();
+
+  for(vtkIdType i = begin; i < end; i++)
+    {
+    NeighborSum<NC>(op, i, nc, x, sum);
+
+    // Row i is m_i + dt K_ii on the diagonal and -dt w_ij for each neighbor.
+    // Isolated nodes have unit mass so that the system stays positive
+    // definite and their values are left unchanged
+    double diag = op.mass[i] + dt * op.Diagonal(i);
+    const double *xi = x + i * nc;
+    double *yi = y + i * nc;
+    for(int j = 0; j < nc; j++)
+      yi[j] = diag * xi[j] - dt * sum[j];
+    }
+}
+
+// One stage of the RKL2 scheme over the rows [begin, end). The neighbor sum
+// is over y1, the other terms only read the entries of row i
+template <int NC>
+void SuperTimeStepStageKernel(const Operator &op, const double *c, int nc_rt,
+                              const double * __restrict y1, const double * __restrict y2,
+                              const double * __restrict y0, const double * __restrict d0,
+                              double * __restrict y, vtkIdType begin, vtkIdType end)
+{
+  const int nc = NC > 0 ? NC : nc_rt;
+  double sum_buf[NC > 0 ? NC : 1];
+  std::vector<double> sum_vec(NC > 0 ? 0 : nc);
+  double *sum = NC > 0 ? sum_buf : sum_vec.data();
+
+  for(vtkIdType i = begin; i < end; i++)
+    {
+    NeighborSum<NC>(op, i, nc, y1, sum);
+
+    double w = c[4] * op.inv_mass[i], d = op.Diagonal(i);
+    vtkIdType ii = i * nc;
+    for(int j = 0; j < nc; j++)
+      y[ii+j] = c[0] * y1[ii+j] + c[1] * y2[ii+j] + c[2] * y0[ii+j] + c[3] * d0[ii+j]
+        + w * (sum[j] - d * y1[ii+j]);
+    }
+}
+
+// The coefficient b_j of the RKL2 scheme of Meyer, Balsara and Aslam (2014)
+double SuperTimeStepCoefficient(int j)
+{
+  return j < 2 ? 1.0 / 3.0 : (j * j + j - 2.0) / (2.0 * j * (j + 1.0));
+}
+
+// Call a kernel specialized for the number of components
+#define GRAPH_LAPLACIAN_DISPATCH(kernel, nc, ...) \
+  switch(nc) \
+    { \
+    case 1: kernel<1>(__VA_ARGS__); break; \
+    case 3: kernel<3>(__VA_ARGS__); break; \
+    case 6: kernel<6>(__VA_ARGS__); break; \
+    case 9: kernel<9>(__VA_ARGS__); break; \
+    default: kernel<0>(__VA_ARGS__); break; \
+    }
+
+} // namespace
+
+using namespace graph_laplacian;
+
+GraphLaplacian::GraphLaplacian(const MeshAdjacency &adj, ThreadPool *pool,
+                               const CotangentWeights *weights)
+  : m_Adj(adj), m_Pool(pool), m_Weights(weights)
+{
+  // The mass of each node and its inverse. Nodes that are isolated or have
+  // no mass get unit mass in the implicit system and do not change
+  vtkIdType n = adj.GetNumberOfNodes();
+  m_Mass.resize(n);
+  m_InvMass.resize(n);
+  for(vtkIdType i = 0; i < n; i++)
+    {
+    double m = weights ? weights->GetMass()[i] : adj.GetDegree(i);
+    m_Mass[i] = m > 0.0 ? m : 1.0;
+    m_InvMass[i] = m > 0.0 ? 1.0 / m : 0.0;
+    }
+}
+
+vtkIdType
+GraphLaplacian::GetNumberOfNodes() const
+{
+  return m_Adj.GetNumberOfNodes();
+}
+
+GraphLaplacian::Operator
+GraphLaplacian::GetOperator() const
+{
+  Operator op;
+  op.offset = m_Adj.GetOffsets();
+  op.nbr = m_Adj.GetNeighbors();
+  op.weight = m_Weights ? m_Weights->GetWeights() : NULL;
+  op.diag = m_Weights ? m_Weights->GetDiagonal() : NULL;
+  op.inv_mass = m_InvMass.data();
+  op.mass = m_Mass.data();
+  return op;
+}
+
+void
+GraphLaplacian::ExplicitStep(double dt, int nc, const double *f, double *f_out)
+{
+  Operator op = this->GetOperator();
+
+  // This is a gather: node i reads its neighbors in f and writes only its
+  // own entries of f_out, so the nodes can be split among threads without
+  // any synchronization
+  typedef ExplicitStepKernel<double, double> Kernel;
+  m_Pool->ParallelFor(m_Adj.GetNumberOfNodes(), [&](vtkIdType begin, vtkIdType end)
+    {
+    GRAPH_LAPLACIAN_DISPATCH(Kernel::Run, nc,
+      op, dt, nc, f, f_out, begin, end);
+    });
+}
+
+void
+GraphLaplacian::ExplicitStep(double dt, int nc, const float *f, float *f_out,
+                             bool accumulate_double)
+{
+  Operator op = this->GetOperator();
+
+  typedef ExplicitStepKernel<float, float> FloatKernel;
+  typedef ExplicitStepKernel<float, double> MixedKernel;
+  m_Pool->ParallelFor(m_Adj.GetNumberOfNodes(), [&](vtkIdType begin, vtkIdType end)
+    {
+    if(accumulate_double)
+      {
+      GRAPH_LAPLACIAN_DISPATCH(MixedKernel::Run, nc,
+        op, dt, nc, f, f_out, begin, end);
+      }
+    else
+      {
+      GRAPH_LAPLACIAN_DISPATCH(FloatKernel::Run, nc,
+        op, dt, nc, f, f_out, begin, end);
+      }
+    });
+}
+
+double
+GraphLaplacian::GetStableTimeStep() const
+{
+  // Row sums of |K| over the mass. Cotangent weights can be negative at
+  // obtuse angles, so the magnitudes of the weights are added up. For the
+  // umbrella operator this is 2 at every node with neighbors
+  Operator op = this->GetOperator();
+  double row_max = 0.0;
+  for(vtkIdType i = 0; i < m_Adj.GetNumberOfNodes(); i++)
+    {
+    double row = std::fabs(op.Diagonal(i));
+    if(op.weight)
+      {
+      for(vtkIdType k = op.offset[i]; k < op.offset[i+1]; k++)
+        row += std::fabs(op.weight[k]);
+      }
+    else
+      {
+      row += op.offset[i+1] - op.offset[i];
+      }
+    row_max = std::max(row_max, row * op.inv_mass[i]);
+    }
+
+  // Without edges nothing changes and any step is stable
+  return row_max > 0.0 ? 2.0 / row_max : 1.0;
+}
+
+int
+GraphLaplacian::GetSuperTimeStepStages(double tau, double dt_stable)
+{
+  // RKL2 with s stages is stable for tau <= dt_stable (s^2 + s - 2) / 4
+  double s = (std::sqrt(9.0 + 16.0 * tau / dt_stable) - 1.0) / 2.0;
+  return std::max(2, (int) std::ceil(s - 1e-9));
+}
+
+void
+GraphLaplacian::SuperTimeStepStage(int nc, const double *c, const double *y1, const double *y2,
+                                   const double *y0, const double *d0, double *y)
+{
+  Operator op = this->GetOperator();
+
+  m_Pool->ParallelFor(m_Adj.GetNumberOfNodes(), [&](vtkIdType begin, vtkIdType end)
+    {
+    GRAPH_LAPLACIAN_DISPATCH(SuperTimeStepStageKernel, nc,
+      op, c, nc, y1, y2, y0, d0, y, begin, end);
+    });
+}
+
+void
+GraphLaplacian::SuperTimeStep(double tau, int s, int nc, const double *f, double *f_out)
+{
+  vtkIdType n = m_Adj.GetNumberOfNodes();
+  std::vector<double> d0(n * nc), buf[3];
+  for(int k = 0; k < 3; k++)
+    buf[k].resize(n * nc);
+
+  // The operator applied to the initial data, d0 = -L f, is used by all stages
+  double w1 = 4.0 / (s * s + s - 2.0);
+  double c_d0[5] = { 0.0, 0.0, 0.0, 0.0, 1.0 };
+  this->SuperTimeStepStage(nc, c_d0, f, f, f, f, d0.data());
+
+  // First stage, Y1 = Y0 + b_1 w1 tau d0
+  double c_y1[5] = { 1.0, 0.0, 0.0, 0.0, SuperTimeStepCoefficient(1) * w1 * tau };
+  this->SuperTimeStepStage(nc, c_y1, f, f, f, d0.data(), buf[0].data());
+
+  // Three term recurrence, keeping the previous two stages
+  const double *y2 = f, *y1 = buf[0].data();
+  for(int j = 2; j <= s; j++)
+    {
+    double b_j = SuperTimeStepCoefficient(j);
+    double b_j1 = SuperTimeStepCoefficient(j - 1), b_j2 = SuperTimeStepCoefficient(j - 2);
+    double mu = (2.0 * j - 1.0) / j * b_j / b_j1;
+    double nu = -(j - 1.0) / j * b_j / b_j2;
+    double mu_tilde = mu * w1;
+    double gamma_tilde = -(1.0 - b_j1) * mu_tilde;
+
+    double c[5] = { mu, nu, 1.0 - mu - nu, gamma_tilde * tau, mu_tilde * tau };
+    double *y = (j == s) ? f_out : buf[(j - 1) % 3].data();
+    this->SuperTimeStepStage(nc, c, y1, y2, f, d0.data(), y);
+    y2 = y1;
+    y1 = y;
+    }
+}
+
+void
+GraphLaplacian::MultiplyImplicit(double dt, int nc, const double *x, double *y)
+{
+  Operator op = this->GetOperator();
+  m_Pool->ParallelFor(m_Adj.GetNumberOfNodes(), [&](vtkIdType begin, vtkIdType end)
+    {
+    GRAPH_LAPLACIAN_DISPATCH(MultiplyImplicitKernel, nc,
+      op, dt, nc, x, y, begin, end);
+    });
+}
+
+void
+GraphLaplacian::Dot(int nc, const double *x, const double *y, double *out)
+{
+  vtkIdType n = m_Adj.GetNumberOfNodes();
+  std::vector<double> partial(ReductionBlocks * nc, 0.0);
+  m_Pool->ParallelFor(ReductionBlocks, [&](vtkIdType b0, vtkIdType b1)
+    {
+    for(vtkIdType b = b0; b < b1; b++)
+      {
+      vtkIdType begin = n * b / ReductionBlocks, end = n * (b + 1) / ReductionBlocks;
+      double *p = &partial[b * nc];
+      for(vtkIdType i = begin; i < end; i++)
+        for(int j = 0; j < nc; j++)
+          p[j] += x[i * nc + j] * y[i * nc + j];
+      }
+    });
+
+  for(int j = 0; j < nc; j++)
+    {
+    out[j] = 0.0;
+    for(int b = 0; b < ReductionBlocks; b++)
+      out[j] += partial[b * nc + j];
+    }
+}
+
+int
+GraphLaplacian::ImplicitStep(double dt, int nc, const double *f, double *u,
+                             double tol, int max_iter)
+{
+  vtkIdType n = m_Adj.GetNumberOfNodes();
+  Operator op = this->GetOperator();
+  std::vector<double> b(n * nc), r(n * nc), z(n * nc), p(n * nc), q(n * nc);
+
+  // Right hand side M f and the inverse diagonal used as the preconditioner
+  std::vector<double> inv_diag(n);
+  m_Pool->ParallelFor(n, [&](vtkIdType begin, vtkIdType end)
+    {
+    for(vtkIdType i = begin; i < end; i++)
+      {
+      inv_diag[i] = 1.0 / (op.mass[i] + dt * op.Diagonal(i));
+      for(int j = 0; j < nc; j++)
+        b[i * nc + j] = op.mass[i] * f[i * nc + j];
+      }
+    });
+
+  // Initial residual r = b - A u, search direction p = z = P r
+  this->MultiplyImplicit(dt, nc, u, q.data());
+  m_Pool->ParallelFor(n, [&](vtkIdType begin, vtkIdType end)
+    {
+    for(vtkIdType i = begin; i < end; i++)
+      for(int j = 0; j < nc; j++)
+        {
+        vtkIdType ij = i * nc + j;
+        r[ij] = b[ij] - q[ij];
+        p[ij] = z[ij] = inv_diag[i] * r[ij];
+        }
+    });
+
+  std::vector<double> b_norm(nc), r_norm(nc), rz(nc), rz_new(nc), pq(nc);
+  std::vector<double> alpha(nc), beta(nc);
+  std::vector<bool> done(nc, false);
+  this->Dot(nc, b.data(), b.data(), b_norm.data());
+  this->Dot(nc, r.data(), z.data(), rz.data());
+
+  int iter;
+  for(iter = 0; iter < max_iter; iter++)
+    {
+    // Check convergence of each component
+    this->Dot(nc, r.data(), r.data(), r_norm.data());
+    bool all_done = true;
+    for(int j = 0; j < nc; j++)
+      {
+      done[j] = done[j] || r_norm[j] <= tol * tol * b_norm[j];
+      all_done = all_done && done[j];
+      }
+    if(all_done)
+      break;
+
+    // Step along the search direction, converged components stay put
+    this->MultiplyImplicit(dt, nc, p.data(), q.data());
+    this->Dot(nc, p.data(), q.data(), pq.data());
+    for(int j = 0; j < nc; j++)
+      alpha[j] = (done[j] || pq[j] <= 0.0) ? 0.0 : rz[j] / pq[j];
+
+    m_Pool->ParallelFor(n, [&](vtkIdType begin, vtkIdType end)
+      {
+      for(vtkIdType i = begin; i < end; i++)
+        for(int j = 0; j < nc; j++)
+          {
+          vtkIdType ij = i * nc + j;
+          u[ij] += alpha[j] * p[ij];
+          r[ij] -= alpha[j] * q[ij];
+          z[ij] = inv_diag[i] * r[ij];
+          }
+      });
+
+    // Update the search direction
+    this->Dot(nc, r.data(), z.data(), rz_new.data());
+    for(int j = 0; j < nc; j++)
+      {
+      beta[j] = (done[j] || rz[j] == 0.0) ? 0.0 : rz_new[j] / rz[j];
+      rz[j] = rz_new[j];
+      }
+
+    m_Pool->ParallelFor(n, [&](vtkIdType begin, vtkIdType end)
+      {
+      for(vtkIdType i = begin; i < end; i++)
+        for(int j = 0; j < nc; j++)
+          p[i * nc + j] = z[i * nc + j] + beta[j] * p[i * nc + j];
+      });
+    }
+
+  return iter;
+}
@@ -0,0 +1,130 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    GraphLaplacian.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __GraphLaplacian_h_
+#define __GraphLaplacian_h_
+
+#include <vtkType.h>
+#include <vector>
+
+class MeshAdjacency;
+class CotangentWeights;
+class ThreadPool;
+
+/**
+ * The Laplacian over a MeshAdjacency graph, written as L = M^-1 K with the
+ * stiffness matrix K and the diagonal mass matrix M. By default this is the
+ * umbrella operator, with K = D - A and M = D, where A is the adjacency
+ * matrix and D holds the node degrees. With CotangentWeights, it is the
+ * finite element Laplacian of the mesh, which does not depend on how finely
+ * the mesh is sampled. The heat equation dF/dt = -L F is what DiffuseArray
+ * integrates. All operations work on arrays of nc interleaved components
+ * and run on a thread pool.
+ */
+class GraphLaplacian
+{
+public:
+
+  /** Create the operator, weights must be computed for adj if given */
+  GraphLaplacian(const MeshAdjacency &adj, ThreadPool *pool,
+                 const CotangentWeights *weights = NULL);
+
+  /** Number of nodes in the graph */
+  vtkIdType GetNumberOfNodes() const;
+
+  /** The graph */
+  const MeshAdjacency &GetAdjacency() const { return m_Adj; }
+
+  /** Mass of node i, unit mass for nodes without any */
+  double GetMass(vtkIdType i) const { return m_Mass[i]; }
+
+  // Arrays that define the operator, used by the kernels
+  struct Operator;
+
+  /** One explicit Euler step, f_out = f - dt L f */
+  void ExplicitStep(double dt, int nc, const double *f, double *f_out);
+
+  /**
+   * Explicit step in single precision, which halves the memory traffic. If
+   * accumulate_double is set, the sums over neighbors are kept in double.
+   */
+  void ExplicitStep(double dt, int nc, const float *f, float *f_out,
+                    bool accumulate_double = false);
+
+  /**
+   * One backward Euler step, i.e. solve (M + dt K) u = M f. On input u holds
+   * the initial guess. All components are solved together by Jacobi-
+   * preconditioned conjugate gradient until the relative residual of each
+   * is below tol. Returns the number of iterations.
+   */
+  int ImplicitStep(double dt, int nc, const double *f, double *u,
+                   double tol = 1e-8, int max_iter = 1000);
+
+  /**
+   * The largest stable step of the explicit scheme. By the Gershgorin bound
+   * the eigenvalues of L are at most max_i (Sum_j |K_ij| / M_ii), and Euler
+   * steps are stable up to 2 over the largest eigenvalue.
+   */
+  double GetStableTimeStep() const;
+
+  /**
+   * Number of stages needed by SuperTimeStep to take a step of length tau
+   * stably, given the stable explicit step dt_stable
+   */
+  static int GetSuperTimeStepStages(double tau, double dt_stable);
+
+  /**
+   * One step of length tau of the second order Runge-Kutta-Legendre (RKL2)
+   * super time stepping scheme with s stages. Each stage costs about as much
+   * as an explicit step, but the stable step grows as s^2, so diffusing to
+   * a large time needs far fewer sweeps over the mesh than Euler steps.
+   */
+  void SuperTimeStep(double tau, int s, int nc, const double *f, double *f_out);
+
+protected:
+
+  // The operator arrays for the kernels
+  Operator GetOperator() const;
+
+  // One stage of the RKL2 scheme, computed in a single sweep as
+  // y = c[0] y1 + c[1] y2 + c[2] y0 + c[3] d0 - c[4] L y1, where d0 = -L y0
+  void SuperTimeStepStage(int nc, const double *c, const double *y1, const double *y2,
+                          const double *y0, const double *d0, double *y);
+
+  // Product y = (M + dt K) x
+  void MultiplyImplicit(double dt, int nc, const double *x, double *y);
+
+  // Per-component dot products of two arrays, computed over a fixed set of
+  // blocks so that the result does not depend on the number of threads
+  void Dot(int nc, const double *x, const double *y, double *out);
+
+  const MeshAdjacency &m_Adj;
+  ThreadPool *m_Pool;
+  const CotangentWeights *m_Weights;
+
+  // Mass of each node and its inverse, which is zero for nodes without mass
+  std::vector<double> m_Mass, m_InvMass;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MappedFile.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "MappedFile.h"
+#include "Mesh3D.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mapped_file {
+
+// Files kept mapped for the sections wrapped by VTK arrays
+std::mutex RegistryMutex;
+std::map<void *, std::shared_ptr<MappedFile> > Registry;
+
+} // namespace
+
+using namespace mapped_file;
+
+MappedFile::MappedFile()
+  : m_Data(NULL), m_Size(0), m_Mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+  this->Close();
+}
+
+void
+MappedFile::Open(const std::string &fn)
+{
+  this->Close();
+
+#ifndef _WIN32
+  int fd = open(fn.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw MeshException("Unable to open file %s", fn.c_str());
+
+  struct stat st;
+  if(fstat(fd, &st) != 0)
+    {
+    close(fd);
+    throw MeshException("Unable to get the size of file %s", fn.c_str());
+    }
+
+  m_Size = (size_t) st.st_size;
+  if(m_Size > 0)
+    {
+    void *p = mmap(NULL, m_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED)
+      {
+      close(fd);
+      m_Size = 0;
+      throw MeshException("Unable to map file %s into memory", fn.c_str());
+      }
+    m_Data = (char *) p;
+    m_Mapped = true;
+    }
+
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+#else
+  FILE *f = fopen(fn.c_str(), "rb");
+  if(!f)
+    throw MeshException("Unable to open file %s", fn.c_str());
+
+  fseek(f, 0, SEEK_END);
+  m_Size = (size_t) ftell(f);
+  fseek(f, 0, SEEK_SET);
+  m_Data = (char *) malloc(m_Size > 0 ? m_Size : 1);
+  size_t n_read = m_Data ? fread(m_Data, 1, m_Size, f) : 0;
+  fclose(f);
+  if(n_read != m_Size)
+    {
+    this->Close();
+    throw MeshException("Unable to read file %s", fn.c_str());
+    }
+#endif
+}
+
+void
+MappedFile::Close()
+{
+#ifndef _WIN32
+  if(m_Mapped)
+    munmap(m_Data, m_Size);
+#else
+  free(m_Data);
+#endif
+  m_Data = NULL;
+  m_Size = 0;
+  m_Mapped = false;
+}
+
+void
+MappedFile::RetainSection(const std::shared_ptr<MappedFile> &file, void *ptr)
+{
+  std::lock_guard<std::mutex> lock(RegistryMutex);
+  Registry[ptr] = file;
+}
+
+void
+MappedFile::ReleaseSection(void *ptr)
+{
+  // The file is unmapped when its last section is released. The reference
+  // is dropped outside of the lock, since that may unmap the file
+  std::shared_ptr<MappedFile> file;
+    {
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+    std::map<void *, std::shared_ptr<MappedFile> >::iterator it = Registry.find(ptr);
+    if(it != Registry.end())
+      {
+      file = it->second;
+      Registry.erase(it);
+      }
+    }
+}
@@ -0,0 +1,73 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MappedFile.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __MappedFile_h_
+#define __MappedFile_h_
+
+#include <memory>
+#include <string>
+
+/**
+ * A file mapped into memory for reading. The pages are private and copy on
+ * write, so data in the mapping can be modified in place without changing
+ * the file. The mapping can be shared with VTK arrays that wrap sections of
+ * it: RetainSection keeps the file mapped until VTK calls ReleaseSection,
+ * which has the signature of a VTK array free function. On platforms
+ * without mmap, the file is read into memory instead.
+ */
+class MappedFile
+{
+public:
+
+  MappedFile();
+  ~MappedFile();
+
+  /** Map the file, throws a MeshException if this fails */
+  void Open(const std::string &fn);
+
+  /** Unmap the file */
+  void Close();
+
+  /** Start and size of the mapping */
+  char *GetData() const { return m_Data; }
+  size_t GetSize() const { return m_Size; }
+
+  /** Keep the file mapped while ptr, which points into it, is in use */
+  static void RetainSection(const std::shared_ptr<MappedFile> &file, void *ptr);
+
+  /** Release a section retained with RetainSection */
+  static void ReleaseSection(void *ptr);
+
+private:
+
+  // Not copyable
+  MappedFile(const MappedFile &);
+  void operator = (const MappedFile &);
+
+  char *m_Data;
+  size_t m_Size;
+  bool m_Mapped;
+};
+
+#endif
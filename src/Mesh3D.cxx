@@ -26,15 +26,105 @@
 #include <CommandLineHelper.h>
 
 #include "CommandAdapter.h"
+#include "CommandPlan.h"
+#include "MeshCache.h"
+#include "MeshServer.h"
+#include "MeshTopology.h"
+#include "ScratchStore.h"
+#include "ThreadPool.h"
 
 #include "AddArray.h"
 #include "DiffuseArray.h"
 #include "DumpArray.h"
 #include "PrintInfo.h"
 #include "ReadMesh.h"
+#include "ReorderMesh.h"
 #include "WriteMesh.h"
 
 #include <vtkPolyData.h>
+#include <vtkPointData.h>
+#include <vtkCellData.h>
+#include <vtksys/Glob.hxx>
+#include <vtksys/SystemTools.hxx>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace mesh3d {
+
+// Stand-in item for checking the pipeline of a batch. Every pattern in the
+// pipeline is replaced by a string that contains the marker
+const char *PipelineItem = "{item}/{item}.{item}";
+const char *PipelineItemMarker = "{item}";
+
+// The inputs of a batch: the files that match a glob pattern, or the lines
+// of a list file, skipping blank lines and comments
+std::vector<string> GetBatchItems(const string &spec)
+{
+  std::vector<string> items;
+  if(spec.find_first_of("*?[") != string::npos)
+    {
+    vtksys::Glob glob;
+    glob.FindFiles(spec);
+    items = glob.GetFiles();
+    std::sort(items.begin(), items.end());
+    }
+  else
+    {
+    std::ifstream fs(spec.c_str());
+    if(!fs)
+      throw MeshException("Unable to read the list of inputs %s", spec.c_str());
+
+    string line;
+    while(std::getline(fs, line))
+      {
+      size_t first = line.find_first_not_of(" \t\r");
+      if(first == string::npos || line[first] == '#')
+        continue;
+      size_t last = line.find_last_not_of(" \t\r");
+      items.push_back(line.substr(first, last - first + 1));
+      }
+    }
+
+  if(items.empty())
+    throw MeshException("No inputs found for -foreach %s", spec.c_str());
+  return items;
+}
+
+// Replace the patterns in an argument of a batch pipeline for an item, as
+// in GNU parallel: {} is the item, {/} its file name, {//} its directory,
+// {.} the item without extension and {/.} the file name without extension
+string SubstituteItem(const string &arg, const string &item)
+{
+  string dir = vtksys::SystemTools::GetFilenamePath(item);
+  string name = vtksys::SystemTools::GetFilenameName(item);
+  string stem = vtksys::SystemTools::GetFilenameWithoutLastExtension(item);
+  const char *patterns[] = { "{}", "{/}", "{//}", "{.}", "{/.}" };
+  string values[] = { item, name, dir, dir.empty() ? stem : dir + "/" + stem, stem };
+
+  string out;
+  for(size_t i = 0; i < arg.size(); )
+    {
+    int match = -1;
+    for(int p = 0; p < 5 && match < 0; p++)
+      if(arg.compare(i, strlen(patterns[p]), patterns[p]) == 0)
+        match = p;
+    if(match >= 0)
+      {
+      out += values[match];
+      i += strlen(patterns[match]);
+      }
+    else
+      out += arg[i++];
+    }
+  return out;
+}
+
+} // namespace
+
+using namespace mesh3d;
 
 Mesh3D::Mesh3D()
 {
@@ -44,11 +134,25 @@ Mesh3D::Mesh3D()
   m_Adapters.push_back(new DumpArray(this));
   m_Adapters.push_back(new PrintInfo(this));
   m_Adapters.push_back(new ReadMesh(this));
+  m_Adapters.push_back(new ReorderMesh(this));
   m_Adapters.push_back(new WriteMesh(this));
 
   // Global flags
   m_Verbose = false;
   m_CellMode = false;
+  m_ThreadPool = new ThreadPool(1);
+  m_ScratchStore = new ScratchStore();
+  m_MeshCache = NULL;
+  m_MeshCacheSize = 8;
+  m_Output = &std::cout;
+  m_Plan = NULL;
+  m_ScriptDepth = 0;
+}
+
+Mesh3D::~Mesh3D()
+{
+  delete m_ThreadPool;
+  delete m_ScratchStore;
 }
 
 void Mesh3D::ProcessCommandLine(const int argc, char *argv[])
@@ -56,44 +160,349 @@ void Mesh3D::ProcessCommandLine(const int argc, char *argv[])
   // Command line helper
   CommandLineHelper cl(argc, argv);
 
-  // Parse the command line
+  // Parse the command line, running each command as it is parsed
+  this->ParseCommands(cl, NULL);
+}
+
+void Mesh3D::ParseCommands(CommandLineHelper &cl, const std::vector<int> *lines)
+{
   while(!cl.is_at_end())
     {
-    // Try 'built-in' commands
-    if(cl.try_command("-verbose"))
+    // Label for the plan step of the command, with its line in a script
+    int pos = cl.get_position();
+    std::ostringstream label;
+    label << cl.peek_arg();
+    if(lines)
+      label << ", line " << (*lines)[pos];
+    m_StepLabel = label.str();
+
+    try
       {
-      m_Verbose = true;
+      this->ParseCommand(cl, lines);
       }
-    else if(cl.try_command("-cell-mode") || cl.try_command("-cm"))
+    catch(std::exception &exc)
       {
-      m_CellMode = true;
+      if(!lines)
+        throw;
+      string context = "Error in command " + m_StepLabel;
+      throw MeshException("%s", CommandPlan::FormatError(context, exc.what()).c_str());
       }
-    else if(cl.try_command("-point-mode") || cl.try_command("-pm"))
+    }
+}
+
+void Mesh3D::ParseCommand(CommandLineHelper &cl, const std::vector<int> *lines)
+{
+  // Try 'built-in' commands
+  if(cl.try_command("-verbose"))
+    {
+    this->Schedule([this]() { m_Verbose = true; });
+    }
+  else if(cl.try_command("-cell-mode") || cl.try_command("-cm"))
+    {
+    this->Schedule([this]() { m_CellMode = true; });
+    }
+  else if(cl.try_command("-point-mode") || cl.try_command("-pm"))
+    {
+    this->Schedule([this]() { m_CellMode = false; });
+    }
+  else if(cl.try_command("-threads"))
+    {
+    long n = cl.read_integer();
+    if(n < 1)
+      throw MeshException("Number of threads must be positive, got %ld", n);
+    this->Schedule([this, n]() { m_ThreadPool->SetNumberOfThreads((int) n); });
+    }
+  else if(cl.try_command("-scratch-dir"))
+    {
+    string dir = cl.read_string();
+    this->Schedule([this, dir]() { m_ScratchStore->SetDirectory(dir); });
+    }
+  else if(cl.try_command("-memory-budget"))
+    {
+    // The budget is given in megabytes
+    long mb = cl.read_integer();
+    if(mb < 0)
+      throw MeshException("Memory budget must not be negative, got %ld", mb);
+    this->Schedule([this, mb]() { m_ScratchStore->SetMemoryBudget((size_t) mb << 20); });
+    }
+  else if(cl.try_command("-server-cache"))
+    {
+    long n = cl.read_integer();
+    if(n < 0)
+      throw MeshException("Server cache size must not be negative, got %ld", n);
+    this->Schedule([this, n]() { m_MeshCacheSize = (int) n; });
+    }
+  else if(cl.try_command("-server"))
+    {
+    string socket_path = cl.read_output_filename();
+    this->Schedule([this, socket_path]() { this->RunServer(socket_path); });
+    }
+  else if(cl.try_command("-script"))
+    {
+    // A script inside of a script adds its steps to the plan
+    string fn = cl.read_existing_filename();
+    std::shared_ptr<CommandPlan> plan = this->ParseScript(fn, &cl);
+    if(plan)
       {
-      m_CellMode = false;
+      std::ostringstream oss;
+      oss << "Running script " << fn << " with " << plan->GetNumberOfSteps() << " steps" << std::endl;
+      this->Debug(oss.str().c_str());
+      plan->Run();
       }
-    else
+    }
+  else if(cl.try_command("-foreach"))
+    {
+    // The commands up to the matching -endfor form the pipeline
+    string spec = cl.read_string();
+    std::vector<string> pipeline;
+    std::vector<int> pipeline_lines;
+    for(int depth = 0; ; )
       {
-      // Try all adapters until one accepts the command
-      bool command_accepted = false;
-      for(int i = 0; i < m_Adapters.size() && !command_accepted; i++)
-        command_accepted = m_Adapters[i]->Parse(cl);
+      if(cl.is_at_end())
+        throw MeshException("Missing -endfor after -foreach");
+      int line = lines ? (*lines)[cl.get_position()] : 0;
+      string arg = cl.read_arg();
+      if(arg == "-endfor")
+        {
+        if(depth == 0)
+          break;
+        depth--;
+        }
+      else if(arg == "-foreach")
+        {
+        depth++;
+        }
+      pipeline.push_back(arg);
+      pipeline_lines.push_back(line);
+      }
+
+    // The pipeline is checked with the rest of the command line or script
+    this->CheckPipeline(pipeline, lines ? &pipeline_lines : NULL, cl);
+    this->Schedule([this, spec, pipeline]() { this->RunBatch(GetBatchItems(spec), pipeline); });
+    }
+  else
+    {
+    // Try all adapters until one accepts the command
+    bool command_accepted = false;
+    for(int i = 0; i < m_Adapters.size() && !command_accepted; i++)
+      command_accepted = m_Adapters[i]->Parse(cl);
+
+    if(!command_accepted)
+      throw MeshException("Unknown command or argument %s", cl.peek_arg());
+    }
+}
+
+std::shared_ptr<CommandPlan> Mesh3D::ParseScript(const string &fn, CommandLineHelper *outer)
+{
+  if(m_ScriptDepth >= 16)
+    throw MeshException("Scripts are nested too deeply at %s", fn.c_str());
+
+  std::vector<string> args;
+  std::vector<int> lines;
+  CommandPlan::ReadScript(fn, args, lines);
+
+  // The arguments are numbered from one, as on the command line
+  std::vector<string> copy(1, "mesh3d");
+  copy.insert(copy.end(), args.begin(), args.end());
+  std::vector<char *> argv;
+  for(size_t i = 0; i < copy.size(); i++)
+    argv.push_back(&copy[i][0]);
+  lines.insert(lines.begin(), 0);
 
-      if(!command_accepted)
-        throw MeshException("Unknown command or argument %s", cl.peek_arg());
+  // The steps of a script inside of a script go into the enclosing plan
+  std::shared_ptr<CommandPlan> plan;
+  if(!m_Plan)
+    {
+    plan = std::make_shared<CommandPlan>();
+    m_Plan = plan.get();
+    }
+  m_ScriptDepth++;
+  try
+    {
+    CommandLineHelper cl((int) argv.size(), argv.data());
+    if(outer)
+      cl.add_output_files(outer->get_output_files());
+    this->ParseCommands(cl, &lines);
+    if(outer)
+      outer->add_output_files(cl.get_output_files());
+    }
+  catch(std::exception &exc)
+    {
+    m_ScriptDepth--;
+    if(plan)
+      m_Plan = NULL;
+    throw MeshException("%s", CommandPlan::FormatError("Script " + fn, exc.what()).c_str());
+    }
+  m_ScriptDepth--;
+  if(plan)
+    m_Plan = NULL;
+
+  return plan;
+}
+
+void Mesh3D::Schedule(const std::function<void()> &action)
+{
+  if(m_Plan)
+    m_Plan->Add(m_StepLabel, action);
+  else
+    action();
+}
+
+void Mesh3D::RunBatch(const std::vector<string> &items, const std::vector<string> &pipeline)
+{
+  // Each thread of the pool takes the next item until none are left, so
+  // that slow items do not hold up the rest
+  std::vector<string> errors(items.size());
+  std::atomic<size_t> next(0);
+  std::mutex output_mutex;
+  m_ThreadPool->ParallelFor(m_ThreadPool->GetNumberOfThreads(), [&](vtkIdType, vtkIdType)
+    {
+    for(size_t i = next++; i < items.size(); i = next++)
+      {
+      // The adapters read file names and values when they parse, so each
+      // item is parsed from the pipeline with the item filled in
+      std::vector<string> args;
+      for(size_t j = 0; j < pipeline.size(); j++)
+        args.push_back(SubstituteItem(pipeline[j], items[i]));
+
+      // A fresh mesh stack with the global settings, on a single thread
+      std::ostringstream out;
+      try
+        {
+        // The threads are already shared out over the items
+        Mesh3D worker;
+        this->CopySettings(worker);
+        worker.m_ThreadPool->SetNumberOfThreads(1);
+        worker.m_Output = &out;
+        worker.ProcessCommandLine(args);
+        }
+      catch(std::exception &exc)
+        {
+        errors[i] = exc.what();
+        }
+
+      // The output of each item is passed on in one piece
+      std::lock_guard<std::mutex> lock(output_mutex);
+      this->Info(out.str().c_str());
+      }
+    });
+
+  // Report the items that failed, the batch fails if any did
+  int n_failed = 0;
+  for(size_t i = 0; i < items.size(); i++)
+    {
+    if(errors[i].size())
+      {
+      std::ostringstream oss;
+      oss << "Failed on " << items[i] << ": " << errors[i] << std::endl;
+      this->Info(oss.str().c_str());
+      n_failed++;
       }
     }
+
+  if(n_failed)
+    throw MeshException("Batch failed on %d of %d inputs", n_failed, (int) items.size());
+
+  std::ostringstream oss;
+  oss << "Batch completed on " << items.size() << " inputs with "
+      << m_ThreadPool->GetNumberOfThreads() << " threads" << std::endl;
+  this->Debug(oss.str().c_str());
+}
+
+void Mesh3D::RunServer(const string &socket_path)
+{
+  MeshServer server(socket_path);
+  MeshCache cache(m_MeshCacheSize);
+  std::ostringstream oss;
+  oss << "Serving on " << socket_path << std::endl;
+  this->Info(oss.str().c_str());
+
+  // Each request runs in a fresh Mesh3D with the global settings, which
+  // shares the cache and writes its output to the client
+  server.Run([&](const std::vector<string> &args, std::ostream &out)
+    {
+    try
+      {
+      Mesh3D session;
+      this->CopySettings(session);
+      session.m_MeshCache = &cache;
+      session.m_Output = &out;
+      session.ProcessCommandLine(args);
+      return true;
+      }
+    catch(std::exception &exc)
+      {
+      out << "Processing failed due to exception" << std::endl;
+      out << exc.what() << std::endl;
+      return false;
+      }
+    });
+}
+
+void Mesh3D::CheckPipeline(const std::vector<string> &pipeline, const std::vector<int> *lines,
+                           CommandLineHelper &outer) const
+{
+  std::vector<string> args(1, "mesh3d");
+  for(size_t j = 0; j < pipeline.size(); j++)
+    args.push_back(SubstituteItem(pipeline[j], PipelineItem));
+  std::vector<int> arg_lines(1, 0);
+  if(lines)
+    arg_lines.insert(arg_lines.end(), lines->begin(), lines->end());
+  std::vector<char *> argv;
+  for(size_t i = 0; i < args.size(); i++)
+    argv.push_back(&args[i][0]);
+
+  // The steps go into a plan that is never run
+  CommandPlan plan;
+  Mesh3D checker;
+  checker.m_Plan = &plan;
+  CommandLineHelper cl((int) argv.size(), argv.data());
+  cl.set_deferred_file_marker(PipelineItemMarker);
+  cl.add_output_files(outer.get_output_files());
+  try
+    {
+    checker.ParseCommands(cl, lines ? &arg_lines : NULL);
+    }
+  catch(std::exception &exc)
+    {
+    // Arguments made from the item can only be checked for each item
+    if(!strstr(exc.what(), PipelineItemMarker))
+      throw MeshException("%s", CommandPlan::FormatError("Error in the -foreach pipeline", exc.what()).c_str());
+    }
+
+  // Files the pipeline writes may be read after the loop
+  outer.add_output_files(cl.get_output_files());
+}
+
+void Mesh3D::CopySettings(Mesh3D &other) const
+{
+  other.m_Verbose = m_Verbose;
+  other.m_CellMode = m_CellMode;
+  other.m_ThreadPool->SetNumberOfThreads(m_ThreadPool->GetNumberOfThreads());
+  *other.m_ScratchStore = *m_ScratchStore;
+  other.m_MeshCacheSize = m_MeshCacheSize;
+}
+
+void Mesh3D::ProcessCommandLine(const std::vector<string> &args)
+{
+  // The first argument is the program name, as in main
+  std::vector<string> copy(1, "mesh3d");
+  copy.insert(copy.end(), args.begin(), args.end());
+  std::vector<char *> argv;
+  for(size_t i = 0; i < copy.size(); i++)
+    argv.push_back(&copy[i][0]);
+  this->ProcessCommandLine((int) argv.size(), argv.data());
 }
 
 void Mesh3D::Info(const char *text)
 {
-  std::cout << text;
+  *m_Output << text;
 }
 
 void Mesh3D::Debug(const char *text)
 {
   if(m_Verbose)
-    std::cout << text;
+    *m_Output << text;
 }
 
 Mesh3D::PolyDataPointer Mesh3D::TopPolyData()
@@ -101,7 +510,7 @@ Mesh3D::PolyDataPointer Mesh3D::TopPolyData()
   if(m_Stack.size() == 0)
     throw MeshException("Attempt to pop mesh from an empty stack");
 
-  PointSetPointer p = m_Stack.back();
+  PointSetPointer p = m_Stack.back().mesh;
   PolyDataType *ppd = dynamic_cast<PolyDataType *>(p.GetPointer());
   PolyDataPointer pd = ppd;
   return pd;
@@ -116,7 +525,51 @@ Mesh3D::PolyDataPointer Mesh3D::PopPolyData()
 
 void Mesh3D::Push(PointSetType *data)
 {
-  m_Stack.push_back(data);
+  StackEntry entry;
+  entry.mesh = data;
+  m_Stack.push_back(entry);
+}
+
+void Mesh3D::PushCached(const std::shared_ptr<MeshCacheEntry> &cached)
+{
+  // Commands may change the arrays of the mesh, but not the cached ones
+  PolyDataPointer copy = PolyDataPointer::New();
+  copy->ShallowCopy(cached->mesh);
+  copy->GetPointData()->DeepCopy(cached->mesh->GetPointData());
+  copy->GetCellData()->DeepCopy(cached->mesh->GetCellData());
+
+  StackEntry entry;
+  entry.mesh = copy;
+  entry.cached = cached;
+  m_Stack.push_back(entry);
+}
+
+MeshTopology *Mesh3D::TopTopology()
+{
+  PolyDataPointer pd = this->TopPolyData();
+  if(!pd)
+    throw MeshException("Mesh at the top of the stack is not a polygonal mesh");
+
+  StackEntry &entry = m_Stack.back();
+
+  // Use the topology of a cached mesh unless another session is using it,
+  // in which case this one computes its own rather than waiting. The lock
+  // is recursive, as the same file may be on the stack more than once
+  if(!entry.topology && entry.cached)
+    {
+    auto lock = std::make_shared<std::unique_lock<std::recursive_mutex> >(
+      entry.cached->topology_mutex, std::try_to_lock);
+    if(lock->owns_lock())
+      {
+      entry.topology_lock = lock;
+      entry.topology = entry.cached->topology;
+      entry.topology->SetThreadPool(m_ThreadPool);
+      }
+    }
+
+  if(!entry.topology)
+    entry.topology = std::make_shared<MeshTopology>(pd, m_ThreadPool);
+  return entry.topology.get();
 }
 
 
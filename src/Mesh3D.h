@@ -28,6 +28,10 @@
 #include <vtkSmartPointer.h>
 #include <vector>
 #include <string>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <ostream>
 
 using std::string;
 
@@ -35,6 +39,13 @@ class vtkPointSet;
 class vtkPolyData;
 class vtkDataArray;
 class CommandAdapter;
+class ThreadPool;
+class ScratchStore;
+class MeshCache;
+class CommandPlan;
+class CommandLineHelper;
+struct MeshCacheEntry;
+class MeshTopology;
 
 /**
  * A simple exception class with string formatting
@@ -43,12 +54,15 @@ class MeshException : public std::exception
 {
 public:
 
+  // Size of the message buffer, longer messages are truncated
+  enum { BufferSize = 4096 };
+
   MeshException(const char *format, ...)
     {
-    buffer = new char[4096];
+    buffer = new char[BufferSize];
     va_list args;
     va_start (args, format);
-    vsprintf (buffer,format, args);
+    vsnprintf (buffer, BufferSize, format, args);
     va_end (args);
     }
 
@@ -81,27 +95,95 @@ public:
 
   // Constructor
   Mesh3D();
+  ~Mesh3D();
 
   // Main method
   void ProcessCommandLine(int argc, char *argv[]);
 
+  // Parse a script into a plan to be run once it is all checked. Inside of
+  // another script, the steps go into its plan and NULL is returned. The
+  // helper of the enclosing command line, if given, passes the files that
+  // earlier commands write to the script, and gets those the script writes
+  std::shared_ptr<CommandPlan> ParseScript(const string &fn, CommandLineHelper *outer = NULL);
+
+  // Run the action of a command now, or add it to the plan of the script
+  // being parsed
+  void Schedule(const std::function<void()> &action);
+
   // Stack-related methods
   PolyDataPointer PopPolyData();
   PolyDataPointer TopPolyData();
 
   void Push(PointSetType *mesh);
 
+  // Push a copy of a mesh in the cache of the server, which shares its points,
+  // cells and topology, but has its own data arrays
+  void PushCached(const std::shared_ptr<MeshCacheEntry> &entry);
+
+  // Topology of the mesh at the top of the stack, computed on demand
+  MeshTopology *TopTopology();
+
   // Output to standard out and debug stream
   void Debug(const char *text);
   void Info(const char *text);
 
+  // Stream that Info and Debug write to, standard out by default
+  void SetOutput(std::ostream *out) { m_Output = out; }
+
   // Are we using cell mode?
   bool GetCellMode() const { return m_CellMode; }
 
+  // Thread pool used by multithreaded commands
+  ThreadPool *GetThreadPool() const { return m_ThreadPool; }
+
+  // Out-of-core storage of arrays, set with -scratch-dir and -memory-budget
+  ScratchStore *GetScratchStore() const { return m_ScratchStore; }
+
+  // Meshes kept between the requests of the server, NULL otherwise
+  MeshCache *GetMeshCache() const { return m_MeshCache; }
+
 protected:
 
-  // A stack of VTK objects
-  typedef std::vector<PointSetPointer> MeshStack;
+  // Give another Mesh3D the global settings of this one
+  void CopySettings(Mesh3D &other) const;
+
+  // Run a command line given as a list of arguments
+  void ProcessCommandLine(const std::vector<string> &args);
+
+  // Parse commands up to the end of the command line, running them or
+  // adding them to the plan. For scripts, lines gives the script line of
+  // each argument, which goes into the labels of the steps and the errors
+  void ParseCommands(CommandLineHelper &cl, const std::vector<int> *lines);
+
+  // Parse one command, lines are as in ParseCommands
+  void ParseCommand(CommandLineHelper &cl, const std::vector<int> *lines);
+
+  // Run a pipeline of commands for each of the items on the worker threads,
+  // each with its own Mesh3D, substituting the item for patterns like {}
+  void RunBatch(const std::vector<string> &items, const std::vector<string> &pipeline);
+
+  // Parse the pipeline of a batch once for a stand-in item, without running
+  // it, so that mistakes are reported before any of the items are processed.
+  // In a script, lines gives the script line of each pipeline argument.
+  // The outputs of earlier commands are passed as for ParseScript
+  void CheckPipeline(const std::vector<string> &pipeline, const std::vector<int> *lines,
+                     CommandLineHelper &outer) const;
+
+  // Serve command lines sent to a socket, keeping the meshes they read
+  void RunServer(const string &socket_path);
+
+  // A stack of VTK objects, each with its cached topology. Meshes from the
+  // server's cache use the topology of the cache entry while they hold its
+  // lock
+  struct StackEntry
+  {
+    PointSetPointer mesh;
+    std::shared_ptr<MeshTopology> topology;
+    std::shared_ptr<MeshCacheEntry> cached;
+    std::shared_ptr<std::unique_lock<std::recursive_mutex> > topology_lock;
+  };
+
+  typedef std::vector<StackEntry> MeshStack;
   MeshStack m_Stack;
 
   // A list of command adapters
@@ -112,6 +194,25 @@ protected:
 
   // Cell mode for arrays
   bool m_CellMode;
+
+  // Worker threads, set with -threads
+  ThreadPool *m_ThreadPool;
+
+  // Scratch files for large arrays
+  ScratchStore *m_ScratchStore;
+
+  // Cache of the server and the number of meshes it holds, set with
+  // -server-cache
+  MeshCache *m_MeshCache;
+  int m_MeshCacheSize;
+
+  // Stream for Info and Debug
+  std::ostream *m_Output;
+
+  // Plan of the script being parsed, and the label of the current command
+  CommandPlan *m_Plan;
+  string m_StepLabel;
+  int m_ScriptDepth;
 };
 
 
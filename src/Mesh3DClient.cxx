@@ -0,0 +1,57 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    Mesh3DClient.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "MeshServer.h"
+#include "Mesh3D.h"
+#include <iostream>
+#include <sstream>
+
+/**
+ * Client for a mesh3d server started with -server. Sends the command line
+ * to the server and prints its output, which saves the startup of mesh3d
+ * and the reading of meshes the server has cached
+ */
+int main(int argc, char *argv[])
+{
+  if(argc < 2)
+    {
+    std::cerr << "Usage: mesh3d_client <socket> [mesh3d arguments]" << std::endl;
+    std::cerr << "       mesh3d_client <socket> -stop-server" << std::endl;
+    return -1;
+    }
+
+  try
+    {
+    std::vector<std::string> args(argv + 2, argv + argc);
+    std::ostringstream out;
+    int status = MeshServer::Request(argv[1], args, out);
+    (status == 0 ? std::cout : std::cerr) << out.str();
+    return status == 0 ? 0 : -1;
+    }
+  catch(std::exception &exc)
+    {
+    std::cerr << exc.what() << std::endl;
+    return -1;
+    }
+}
@@ -0,0 +1,345 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshAdjacency.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "MeshAdjacency.h"
+#include "Mesh3D.h"
+#include "ThreadPool.h"
+#include <vtkPolyData.h>
+#include <vtkIdList.h>
+#include <vtkSmartPointer.h>
+#include <algorithm>
+#include <climits>
+
+namespace mesh_adjacency {
+
+// Edges of the cell types that we support, as pairs of local vertex indices
+const int TriangleEdges[3][2] = { {0,1}, {1,2}, {0,2} };
+const int TetraEdges[6][2] = { {0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3} };
+
+// Get the edge table for a cell type, returns the number of edges
+int GetCellEdgeTable(int cell_type, const int (*&table)[2])
+{
+  switch(cell_type)
+    {
+    case VTK_TRIANGLE: table = TriangleEdges; return 3;
+    case VTK_TETRA: table = TetraEdges; return 6;
+    default: table = NULL; return 0;
+    }
+}
+
+// Faces of a tetra, as triples of local vertex indices
+const int TetraFaces[4][3] = { {0,1,2}, {0,1,3}, {0,2,3}, {1,2,3} };
+
+// A tetra face or a triangle edge, given by its sorted vertex ids (the last
+// one is -1 for edges), together with the cell it belongs to
+struct SideKey
+{
+  int v[3];
+  int cell;
+
+  bool operator < (const SideKey &o) const
+    {
+    if(v[0] != o.v[0]) return v[0] < o.v[0];
+    if(v[1] != o.v[1]) return v[1] < o.v[1];
+    if(v[2] != o.v[2]) return v[2] < o.v[2];
+    return cell < o.cell;
+    }
+
+  bool SameSide(const SideKey &o) const
+    { return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2]; }
+};
+
+void MakeSideKey(SideKey &key, int cell, vtkIdType a, vtkIdType b, vtkIdType c = -1)
+{
+  if(a > b) std::swap(a, b);
+  if(c >= 0)
+    {
+    if(b > c) std::swap(b, c);
+    if(a > b) std::swap(a, b);
+    }
+  key.v[0] = (int) a; key.v[1] = (int) b; key.v[2] = (int) c;
+  key.cell = cell;
+}
+
+// Sort a vector by sorting one block per thread and then merging the blocks
+template <class T>
+void ParallelSort(std::vector<T> &v, ThreadPool *pool)
+{
+  vtkIdType n = v.size();
+  int nb = pool ? pool->GetNumberOfThreads() : 1;
+  if(nb == 1)
+    {
+    std::sort(v.begin(), v.end());
+    return;
+    }
+
+  std::vector<vtkIdType> bounds(nb + 1);
+  for(int b = 0; b <= nb; b++)
+    bounds[b] = n * b / nb;
+
+  pool->ParallelFor(nb, [&](vtkIdType b0, vtkIdType b1)
+    {
+    for(vtkIdType b = b0; b < b1; b++)
+      std::sort(v.begin() + bounds[b], v.begin() + bounds[b+1]);
+    });
+
+  // Merge pairs of neighboring blocks until one block is left
+  for(int width = 1; width < nb; width *= 2)
+    {
+    int n_merge = (nb + 2 * width - 1) / (2 * width);
+    pool->ParallelFor(n_merge, [&](vtkIdType m0, vtkIdType m1)
+      {
+      for(vtkIdType m = m0; m < m1; m++)
+        {
+        int lo = (int) m * 2 * width, mid = lo + width, hi = std::min(lo + 2 * width, nb);
+        if(mid < hi)
+          std::inplace_merge(v.begin() + bounds[lo], v.begin() + bounds[mid], v.begin() + bounds[hi]);
+        }
+      });
+    }
+}
+
+// Run a loop on the pool if there is one, otherwise in this thread
+void RunLoop(ThreadPool *pool, vtkIdType n, const ThreadPool::RangeFunction &body)
+{
+  if(pool)
+    pool->ParallelFor(n, body);
+  else if(n > 0)
+    body(0, n);
+}
+
+} // namespace
+
+using namespace mesh_adjacency;
+
+void
+MeshAdjacency::Clear()
+{
+  m_Offsets.assign(1, 0);
+  m_Neighbors.clear();
+  m_InvDegree.clear();
+}
+
+size_t
+MeshAdjacency::GetMemorySize() const
+{
+  return m_Offsets.capacity() * sizeof(vtkIdType)
+    + m_Neighbors.capacity() * sizeof(IndexType)
+    + m_InvDegree.capacity() * sizeof(double);
+}
+
+void
+MeshAdjacency::BuildVertexAdjacency(vtkPolyData *mesh, ThreadPool *pool)
+{
+  vtkIdType n = mesh->GetNumberOfPoints();
+  if(n >= INT_MAX)
+    throw MeshException("Mesh has too many vertices (%ld) for adjacency", (long) n);
+
+  // The cell edges are visited twice, first to count the number of (possibly
+  // repeated) neighbors of each vertex, and then to fill the neighbor lists
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  std::vector<vtkIdType> count(n + 1, 0);
+  for(vtkIdType i = 0; i < mesh->GetNumberOfCells(); i++)
+    {
+    const int (*table)[2];
+    int ne = GetCellEdgeTable(mesh->GetCellType(i), table);
+    if(ne == 0)
+      throw MeshException("Wrong cell type for diffusion, must be triangle or tetra");
+
+    mesh->GetCellPoints(i, ids);
+    vtkIdType *p = ids->GetPointer(0);
+    for(int e = 0; e < ne; e++)
+      {
+      count[p[table[e][0]] + 1]++;
+      count[p[table[e][1]] + 1]++;
+      }
+    }
+
+  // Offsets of the uncompacted rows
+  for(vtkIdType i = 0; i < n; i++)
+    count[i+1] += count[i];
+
+  m_Offsets = count;
+  m_Neighbors.resize(m_Offsets[n]);
+
+  // Fill the rows, using count[i] as the insertion point for row i
+  for(vtkIdType i = 0; i < mesh->GetNumberOfCells(); i++)
+    {
+    const int (*table)[2];
+    int ne = GetCellEdgeTable(mesh->GetCellType(i), table);
+    mesh->GetCellPoints(i, ids);
+    vtkIdType *p = ids->GetPointer(0);
+    for(int e = 0; e < ne; e++)
+      {
+      vtkIdType a = p[table[e][0]], b = p[table[e][1]];
+      m_Neighbors[count[a]++] = (IndexType) b;
+      m_Neighbors[count[b]++] = (IndexType) a;
+      }
+    }
+
+  this->CompactRows(pool);
+}
+
+void
+MeshAdjacency::BuildCellAdjacency(vtkPolyData *mesh, ThreadPool *pool,
+                                  std::vector<unsigned char> *boundary)
+{
+  vtkIdType nc = mesh->GetNumberOfCells();
+  if(nc >= INT_MAX || mesh->GetNumberOfPoints() >= INT_MAX)
+    throw MeshException("Mesh is too large (%ld cells) for adjacency", (long) nc);
+
+  // Each tetra contributes its four faces and each triangle its three edges.
+  // Find where the keys of each cell go
+  std::vector<vtkIdType> key_offset(nc + 1, 0);
+  for(vtkIdType i = 0; i < nc; i++)
+    {
+    int type = mesh->GetCellType(i);
+    if(type == VTK_TETRA)
+      key_offset[i+1] = key_offset[i] + 4;
+    else if(type == VTK_TRIANGLE)
+      key_offset[i+1] = key_offset[i] + 3;
+    else
+      throw MeshException("Wrong cell type in CellDataDiffusion");
+    }
+
+  // Generate the keys in parallel
+  std::vector<SideKey> keys(key_offset[nc]);
+  RunLoop(pool, nc, [&](vtkIdType begin, vtkIdType end)
+    {
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    for(vtkIdType i = begin; i < end; i++)
+      {
+      mesh->GetCellPoints(i, ids);
+      vtkIdType *p = ids->GetPointer(0);
+      SideKey *key = &keys[key_offset[i]];
+      if(key_offset[i+1] - key_offset[i] == 4)
+        {
+        for(int f = 0; f < 4; f++)
+          MakeSideKey(key[f], (int) i, p[TetraFaces[f][0]], p[TetraFaces[f][1]], p[TetraFaces[f][2]]);
+        }
+      else
+        {
+        for(int e = 0; e < 3; e++)
+          MakeSideKey(key[e], (int) i, p[TriangleEdges[e][0]], p[TriangleEdges[e][1]]);
+        }
+      }
+    });
+
+  // After sorting, cells that share a face or edge have consecutive keys
+  ParallelSort(keys, pool);
+
+  // Pair up all the cells in each run of equal keys. A key that is not
+  // repeated is a side on the boundary of the mesh
+  std::vector<Edge> edges;
+  if(boundary)
+    boundary->assign(mesh->GetNumberOfPoints(), 0);
+
+  for(size_t k = 0; k < keys.size(); )
+    {
+    size_t k_end = k + 1;
+    while(k_end < keys.size() && keys[k_end].SameSide(keys[k]))
+      k_end++;
+
+    if(boundary && k_end == k + 1)
+      for(int j = 0; j < 3; j++)
+        if(keys[k].v[j] >= 0)
+          (*boundary)[keys[k].v[j]] = 1;
+
+    for(size_t a = k; a < k_end; a++)
+      for(size_t b = a + 1; b < k_end; b++)
+        if(keys[a].cell != keys[b].cell)
+          edges.push_back(Edge(keys[a].cell, keys[b].cell));
+
+    k = k_end;
+    }
+
+  std::vector<SideKey>().swap(keys);
+  this->BuildFromEdges(nc, edges, pool);
+}
+
+void
+MeshAdjacency::BuildFromEdges(vtkIdType n, const std::vector<Edge> &edges, ThreadPool *pool)
+{
+  if(n >= INT_MAX)
+    throw MeshException("Too many nodes (%ld) for adjacency", (long) n);
+
+  // Count the neighbors of each node and compute row offsets
+  m_Offsets.assign(n + 1, 0);
+  for(size_t k = 0; k < edges.size(); k++)
+    {
+    m_Offsets[edges[k].first + 1]++;
+    m_Offsets[edges[k].second + 1]++;
+    }
+  for(vtkIdType i = 0; i < n; i++)
+    m_Offsets[i+1] += m_Offsets[i];
+
+  // Fill the rows
+  std::vector<vtkIdType> pos(m_Offsets.begin(), m_Offsets.end() - 1);
+  m_Neighbors.resize(m_Offsets[n]);
+  for(size_t k = 0; k < edges.size(); k++)
+    {
+    IndexType a = edges[k].first, b = edges[k].second;
+    m_Neighbors[pos[a]++] = b;
+    m_Neighbors[pos[b]++] = a;
+    }
+
+  this->CompactRows(pool);
+}
+
+void
+MeshAdjacency::CompactRows(ThreadPool *pool)
+{
+  vtkIdType n = m_Offsets.size() - 1;
+  m_InvDegree.resize(n);
+
+  // Sort and unique each row in place, recording the new row lengths
+  std::vector<vtkIdType> length(n + 1, 0);
+  RunLoop(pool, n, [&](vtkIdType begin, vtkIdType end)
+    {
+    for(vtkIdType i = begin; i < end; i++)
+      {
+      IndexType *row = m_Neighbors.data() + m_Offsets[i];
+      IndexType *row_end = m_Neighbors.data() + m_Offsets[i+1];
+      std::sort(row, row_end);
+      length[i+1] = std::unique(row, row_end) - row;
+      m_InvDegree[i] = length[i+1] > 0 ? 1.0 / length[i+1] : 0.0;
+      }
+    });
+
+  for(vtkIdType i = 0; i < n; i++)
+    length[i+1] += length[i];
+
+  // Copy the unique entries of each row into a compact array
+  std::vector<IndexType> compact(length[n]);
+  RunLoop(pool, n, [&](vtkIdType begin, vtkIdType end)
+    {
+    for(vtkIdType i = begin; i < end; i++)
+      std::copy(m_Neighbors.begin() + m_Offsets[i],
+                m_Neighbors.begin() + m_Offsets[i] + (length[i+1] - length[i]),
+                compact.begin() + length[i]);
+    });
+
+  m_Offsets.swap(length);
+  m_Neighbors.swap(compact);
+}
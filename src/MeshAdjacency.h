@@ -0,0 +1,100 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshAdjacency.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __MeshAdjacency_h_
+#define __MeshAdjacency_h_
+
+#include <vtkType.h>
+#include <vector>
+#include <utility>
+
+class vtkPolyData;
+class ThreadPool;
+
+/**
+ * Adjacency graph of mesh vertices (or cells) in compressed sparse row (CSR)
+ * form. The neighbors of node i are stored contiguously in the range
+ * [GetOffsets()[i], GetOffsets()[i+1]) of GetNeighbors(). For each node we
+ * also keep the weight 1/|N(i)| used by the umbrella Laplacian.
+ */
+class MeshAdjacency
+{
+public:
+
+  // Type used to store neighbor indices. Four bytes per directed edge is
+  // plenty for any mesh that fits in memory
+  typedef int IndexType;
+
+  // An undirected edge between two nodes
+  typedef std::pair<IndexType, IndexType> Edge;
+
+  MeshAdjacency() { this->Clear(); }
+
+  /** Build the graph of mesh vertices connected by triangle or tetra edges */
+  void BuildVertexAdjacency(vtkPolyData *mesh, ThreadPool *pool = NULL);
+
+  /**
+   * Build the graph of mesh cells, where two tetras are adjacent if they
+   * share a face and two triangles are adjacent if they share an edge. If
+   * boundary is not NULL, it is filled with a flag for each vertex that is
+   * on a face or edge that belongs to only one cell.
+   */
+  void BuildCellAdjacency(vtkPolyData *mesh, ThreadPool *pool = NULL,
+                          std::vector<unsigned char> *boundary = NULL);
+
+  /** Build the graph from a list of undirected edges, duplicates are allowed */
+  void BuildFromEdges(vtkIdType n_nodes, const std::vector<Edge> &edges, ThreadPool *pool = NULL);
+
+  /** Empty the graph */
+  void Clear();
+
+  /** Number of nodes (vertices or cells) in the graph */
+  vtkIdType GetNumberOfNodes() const { return m_Offsets.size() - 1; }
+
+  /** Number of undirected edges in the graph */
+  vtkIdType GetNumberOfEdges() const { return m_Neighbors.size() / 2; }
+
+  /** Number of neighbors of node i */
+  int GetDegree(vtkIdType i) const { return (int) (m_Offsets[i+1] - m_Offsets[i]); }
+
+  /** Raw CSR arrays */
+  const vtkIdType *GetOffsets() const { return m_Offsets.data(); }
+  const IndexType *GetNeighbors() const { return m_Neighbors.data(); }
+  const double *GetInverseDegree() const { return m_InvDegree.data(); }
+
+  /** Memory used by the graph, in bytes */
+  size_t GetMemorySize() const;
+
+protected:
+
+  // Sort and unique each of the rows in m_Neighbors, which may contain
+  // duplicates, then compute the degree weights
+  void CompactRows(ThreadPool *pool);
+
+  std::vector<vtkIdType> m_Offsets;
+  std::vector<IndexType> m_Neighbors;
+  std::vector<double> m_InvDegree;
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshCache.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "MeshCache.h"
+#include "MeshTopology.h"
+#include <vtkPolyData.h>
+#include <vtksys/SystemTools.hxx>
+
+MeshCache::MeshCache(size_t capacity)
+  : m_Capacity(capacity)
+{
+}
+
+std::shared_ptr<MeshCache::Entry>
+MeshCache::Find(const std::string &fn)
+{
+  std::string path = vtksys::SystemTools::CollapseFullPath(fn);
+  long mtime = vtksys::SystemTools::ModifiedTime(path);
+  unsigned long size = vtksys::SystemTools::FileLength(path);
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for(std::list<Item>::iterator it = m_Items.begin(); it != m_Items.end(); ++it)
+    {
+    if(it->path == path)
+      {
+      // A changed file is read again
+      if(it->mtime != mtime || it->size != size)
+        {
+        m_Items.erase(it);
+        return std::shared_ptr<Entry>();
+        }
+
+      m_Items.splice(m_Items.begin(), m_Items, it);
+      return it->entry;
+      }
+    }
+
+  return std::shared_ptr<Entry>();
+}
+
+std::shared_ptr<MeshCache::Entry>
+MeshCache::Insert(const std::string &fn, vtkPolyData *mesh)
+{
+  Item item;
+  item.path = vtksys::SystemTools::CollapseFullPath(fn);
+  item.mtime = vtksys::SystemTools::ModifiedTime(item.path);
+  item.size = vtksys::SystemTools::FileLength(item.path);
+  item.entry = std::make_shared<Entry>();
+  item.entry->mesh = mesh;
+
+  // The topology is computed on first use, with the thread pool of the
+  // session that uses it
+  item.entry->topology = std::make_shared<MeshTopology>(mesh, (ThreadPool *) NULL);
+
+  // Replace an older version of the file, and drop the least recently used
+  // meshes to make room. Sessions still using them keep them alive
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for(std::list<Item>::iterator it = m_Items.begin(); it != m_Items.end(); ++it)
+    {
+    if(it->path == item.path)
+      {
+      m_Items.erase(it);
+      break;
+      }
+    }
+
+  m_Items.push_front(item);
+  while(m_Items.size() > m_Capacity)
+    m_Items.pop_back();
+
+  return item.entry;
+}
+
+size_t
+MeshCache::GetSize()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Items.size();
+}
@@ -0,0 +1,90 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshCache.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __MeshCache_h_
+#define __MeshCache_h_
+
+#include <vtkSmartPointer.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class vtkPolyData;
+class MeshTopology;
+
+/**
+ * A mesh in the MeshCache. Its topology is used by one session at a time,
+ * the one holding topology_mutex
+ */
+struct MeshCacheEntry
+{
+  vtkSmartPointer<vtkPolyData> mesh;
+  std::shared_ptr<MeshTopology> topology;
+  std::recursive_mutex topology_mutex;
+};
+
+/**
+ * A cache of recently read meshes and their topology, shared by the
+ * sessions of the server. Meshes are found by the absolute path of their
+ * file and are read again when the file changes. The least recently used
+ * meshes are dropped when the cache is full. Cached meshes must not be
+ * modified: sessions work on copies that share their points and cells.
+ */
+class MeshCache
+{
+public:
+
+  typedef MeshCacheEntry Entry;
+
+  /** Create a cache that holds up to capacity meshes */
+  MeshCache(size_t capacity);
+
+  /** The entry for a file if it is cached and up to date, otherwise NULL */
+  std::shared_ptr<Entry> Find(const std::string &fn);
+
+  /** Add a mesh read from a file, which must not be modified afterwards */
+  std::shared_ptr<Entry> Insert(const std::string &fn, vtkPolyData *mesh);
+
+  /** Number of meshes in the cache */
+  size_t GetSize();
+
+protected:
+
+  // A file and its size and modification time when it was read
+  struct Item
+  {
+    std::string path;
+    long mtime;
+    unsigned long size;
+    std::shared_ptr<Entry> entry;
+  };
+
+  // Most recently used first
+  std::list<Item> m_Items;
+  std::mutex m_Mutex;
+  size_t m_Capacity;
+};
+
+#endif
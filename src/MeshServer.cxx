@@ -0,0 +1,307 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshServer.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "MeshServer.h"
+#include "Mesh3D.h"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace mesh_server {
+
+const char *StopCommand = "-stop-server";
+
+#ifndef _WIN32
+
+// Address of a socket path, which must fit in sockaddr_un
+sockaddr_un GetAddress(const std::string &path)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(addr.sun_path))
+    throw MeshException("Socket path %s is too long", path.c_str());
+  strcpy(addr.sun_path, path.c_str());
+  return addr;
+}
+
+// Remove a socket left at the path by an earlier server. Returns false if
+// something other than a socket is there, which must not be deleted
+bool RemoveSocket(const std::string &path)
+{
+  struct stat st;
+  if(lstat(path.c_str(), &st) != 0)
+    return true;
+  if(!S_ISSOCK(st.st_mode))
+    return false;
+  unlink(path.c_str());
+  return true;
+}
+
+// Read until the other end shuts down its side of the connection
+bool ReadAll(int fd, std::string &data)
+{
+  char buffer[65536];
+  for(;;)
+    {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if(n == 0)
+      return true;
+    if(n < 0 && errno != EINTR)
+      return false;
+    if(n > 0)
+      data.append(buffer, n);
+    }
+}
+
+// Send all of the data, without raising SIGPIPE if the other end is gone
+bool WriteAll(int fd, const char *data, size_t size)
+{
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  while(size > 0)
+    {
+    ssize_t n = send(fd, data, size, flags);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    data += n;
+    size -= n;
+    }
+  return true;
+}
+
+#endif
+
+} // namespace
+
+using namespace mesh_server;
+
+#ifndef _WIN32
+
+MeshServer::MeshServer(const std::string &socket_path)
+  : m_SocketPath(socket_path), m_Socket(-1)
+{
+  sockaddr_un addr = GetAddress(socket_path);
+  m_Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(m_Socket < 0)
+    throw MeshException("Unable to create a socket: %s", strerror(errno));
+
+  if(!RemoveSocket(socket_path))
+    {
+    close(m_Socket);
+    throw MeshException("Unable to listen on socket %s: the file exists and is not a socket",
+                        socket_path.c_str());
+    }
+  if(bind(m_Socket, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(m_Socket, 64) != 0)
+    {
+    int err = errno;
+    close(m_Socket);
+    throw MeshException("Unable to listen on socket %s: %s", socket_path.c_str(), strerror(err));
+    }
+}
+
+MeshServer::~MeshServer()
+{
+  close(m_Socket);
+  RemoveSocket(m_SocketPath);
+}
+
+void
+MeshServer::Run(const Handler &handler)
+{
+  std::mutex mutex;
+  std::condition_variable done;
+  int active = 0;
+  std::atomic<bool> stop(false);
+
+  while(!stop)
+    {
+    int fd = accept(m_Socket, NULL, NULL);
+    if(fd < 0)
+      {
+      if(errno == EINTR || errno == ECONNABORTED)
+        continue;
+      throw MeshException("Unable to accept connections on %s: %s",
+        m_SocketPath.c_str(), strerror(errno));
+      }
+
+    // Each client is served in its own thread
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      active++;
+      }
+    std::thread([&, fd]()
+      {
+      if(this->Serve(fd, handler))
+        {
+        // Wake up the accept loop with a connection of our own
+        stop = true;
+        int wake = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = GetAddress(m_SocketPath);
+        connect(wake, (sockaddr *) &addr, sizeof(addr));
+        close(wake);
+        }
+      close(fd);
+      std::lock_guard<std::mutex> lock(mutex);
+      if(--active == 0)
+        done.notify_all();
+      }).detach();
+    }
+
+  // Let the requests in progress finish
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&]() { return active == 0; });
+}
+
+bool
+MeshServer::Serve(int fd, const Handler &handler)
+{
+  std::string request;
+  if(!ReadAll(fd, request))
+    return false;
+
+  // The working directory of the client comes first
+  std::vector<std::string> args;
+  for(size_t pos = 0; pos < request.size(); )
+    {
+    size_t end = request.find('\0', pos);
+    if(end == std::string::npos)
+      end = request.size();
+    args.push_back(request.substr(pos, end - pos));
+    pos = end + 1;
+    }
+  if(args.empty())
+    return false;
+  std::string cwd = args.front();
+  args.erase(args.begin());
+
+  if(args.size() == 1 && args[0] == StopCommand)
+    {
+    WriteAll(fd, "\0", 1);
+    return true;
+    }
+
+  // Relative paths are taken relative to the directory of the client. On
+  // Linux each thread can have a working directory of its own, elsewhere
+  // the server's directory is used
+  std::ostringstream out;
+  bool ok = true;
+#ifdef __linux__
+  if(unshare(CLONE_FS) != 0 || chdir(cwd.c_str()) != 0)
+    {
+    out << "Unable to change to directory " << cwd << std::endl;
+    ok = false;
+    }
+#endif
+  if(ok)
+    ok = handler(args, out);
+
+  char status = ok ? 0 : 1;
+  std::string reply = out.str();
+  if(WriteAll(fd, &status, 1))
+    WriteAll(fd, reply.data(), reply.size());
+  return false;
+}
+
+int
+MeshServer::Request(const std::string &socket_path, const std::vector<std::string> &args,
+                    std::ostream &out)
+{
+  sockaddr_un addr = GetAddress(socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+    int err = errno;
+    if(fd >= 0)
+      close(fd);
+    throw MeshException("Unable to connect to server at %s: %s", socket_path.c_str(), strerror(err));
+    }
+
+  char cwd[4096];
+  std::string request = getcwd(cwd, sizeof(cwd)) ? cwd : ".";
+  request.push_back('\0');
+  for(size_t i = 0; i < args.size(); i++)
+    {
+    request += args[i];
+    request.push_back('\0');
+    }
+
+  std::string reply;
+  bool ok = WriteAll(fd, request.data(), request.size())
+    && shutdown(fd, SHUT_WR) == 0 && ReadAll(fd, reply);
+  close(fd);
+  if(!ok || reply.empty())
+    throw MeshException("No reply from server at %s", socket_path.c_str());
+
+  out.write(reply.data() + 1, reply.size() - 1);
+  return reply[0];
+}
+
+#else
+
+MeshServer::MeshServer(const std::string &socket_path)
+  : m_SocketPath(socket_path), m_Socket(-1)
+{
+  throw MeshException("Server mode is not supported on this platform");
+}
+
+MeshServer::~MeshServer()
+{
+}
+
+void
+MeshServer::Run(const Handler &)
+{
+}
+
+bool
+MeshServer::Serve(int, const Handler &)
+{
+  return false;
+}
+
+int
+MeshServer::Request(const std::string &, const std::vector<std::string> &, std::ostream &)
+{
+  throw MeshException("Server mode is not supported on this platform");
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshServer.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __MeshServer_h_
+#define __MeshServer_h_
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * A server that runs command lines sent by clients over a Unix domain
+ * socket, each in its own thread. A request is the working directory of
+ * the client followed by the arguments, each terminated by a NUL byte, and
+ * ends when the client shuts down its end of the connection for writing.
+ * The reply is a status byte, zero for success, followed by the output of
+ * the command line. A request with the single argument -stop-server makes
+ * the server stop once the requests in progress are done.
+ */
+class MeshServer
+{
+public:
+
+  // Runs the arguments of a request, writing the output to out. Returns
+  // false if the command line failed
+  typedef std::function<bool(const std::vector<std::string> &args, std::ostream &out)> Handler;
+
+  /** Listen on a socket, replacing a file left over at its path */
+  MeshServer(const std::string &socket_path);
+
+  /** Close the socket and remove it */
+  ~MeshServer();
+
+  /** Serve requests until a client asks the server to stop */
+  void Run(const Handler &handler);
+
+  /**
+   * Send a request to a server and write its output to out. Returns the
+   * status of the request, zero for success
+   */
+  static int Request(const std::string &socket_path, const std::vector<std::string> &args,
+                     std::ostream &out);
+
+protected:
+
+  // Read a request, run it and send the reply. Returns true if the client
+  // asked the server to stop
+  bool Serve(int fd, const Handler &handler);
+
+  std::string m_SocketPath;
+  int m_Socket;
+};
+
+#endif
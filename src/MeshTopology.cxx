@@ -0,0 +1,144 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshTopology.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "MeshTopology.h"
+#include <vtkPolyData.h>
+#include <vtkCellArray.h>
+#include <vtkPoints.h>
+#include <algorithm>
+
+namespace mesh_topology {
+
+// The latest modification time of the cell arrays of a mesh
+vtkMTimeType GetConnectivityMTime(vtkPolyData *mesh)
+{
+  vtkCellArray *cells[] = { mesh->GetVerts(), mesh->GetLines(), mesh->GetPolys(), mesh->GetStrips() };
+  vtkMTimeType t = 0;
+  for(int i = 0; i < 4; i++)
+    if(cells[i])
+      t = std::max(t, cells[i]->GetMTime());
+  return t;
+}
+
+// The modification time of the point coordinates of a mesh
+vtkMTimeType GetPointsMTime(vtkPolyData *mesh)
+{
+  return mesh->GetPoints() ? mesh->GetPoints()->GetMTime() : 0;
+}
+
+} // namespace
+
+using namespace mesh_topology;
+
+MeshTopology::MeshTopology(vtkPolyData *mesh, ThreadPool *pool)
+  : m_Mesh(mesh), m_Pool(pool), m_ConnectivityMTime(0), m_PointsMTime(0),
+    m_NumberOfPoints(0), m_NumberOfCells(0), m_Valid(0)
+{
+}
+
+void
+MeshTopology::CheckModified()
+{
+  vtkMTimeType t = GetConnectivityMTime(m_Mesh);
+  if(t != m_ConnectivityMTime
+     || m_Mesh->GetNumberOfPoints() != m_NumberOfPoints
+     || m_Mesh->GetNumberOfCells() != m_NumberOfCells)
+    {
+    m_ConnectivityMTime = t;
+    m_NumberOfPoints = m_Mesh->GetNumberOfPoints();
+    m_NumberOfCells = m_Mesh->GetNumberOfCells();
+    m_Valid = 0;
+    }
+
+  // Moving the points only invalidates the items that depend on geometry
+  vtkMTimeType tp = GetPointsMTime(m_Mesh);
+  if(tp != m_PointsMTime)
+    {
+    m_PointsMTime = tp;
+    m_Valid &= ~COTANGENT_WEIGHTS;
+    }
+}
+
+const MeshAdjacency &
+MeshTopology::GetVertexAdjacency()
+{
+  this->CheckModified();
+  if(!(m_Valid & VERTEX_ADJACENCY))
+    {
+    m_VertexAdjacency.BuildVertexAdjacency(m_Mesh, m_Pool);
+    m_Valid |= VERTEX_ADJACENCY;
+    }
+  return m_VertexAdjacency;
+}
+
+const MeshAdjacency &
+MeshTopology::GetCellAdjacency()
+{
+  this->CheckModified();
+  if(!(m_Valid & CELL_ADJACENCY))
+    {
+    m_CellAdjacency.BuildCellAdjacency(m_Mesh, m_Pool, &m_Boundary);
+    m_Valid |= CELL_ADJACENCY;
+    }
+  return m_CellAdjacency;
+}
+
+const std::vector<MeshAdjacency::Edge> &
+MeshTopology::GetEdges()
+{
+  const MeshAdjacency &adj = this->GetVertexAdjacency();
+  if(!(m_Valid & EDGES))
+    {
+    m_Edges.clear();
+    m_Edges.reserve(adj.GetNumberOfEdges());
+    const vtkIdType *offset = adj.GetOffsets();
+    const MeshAdjacency::IndexType *nbr = adj.GetNeighbors();
+    for(vtkIdType i = 0; i < adj.GetNumberOfNodes(); i++)
+      for(vtkIdType k = offset[i]; k < offset[i+1]; k++)
+        if(nbr[k] > i)
+          m_Edges.push_back(MeshAdjacency::Edge((MeshAdjacency::IndexType) i, nbr[k]));
+    m_Valid |= EDGES;
+    }
+  return m_Edges;
+}
+
+const CotangentWeights &
+MeshTopology::GetCotangentWeights()
+{
+  const MeshAdjacency &adj = this->GetVertexAdjacency();
+  if(!(m_Valid & COTANGENT_WEIGHTS))
+    {
+    m_CotangentWeights.Compute(m_Mesh, adj);
+    m_Valid |= COTANGENT_WEIGHTS;
+    }
+  return m_CotangentWeights;
+}
+
+const std::vector<unsigned char> &
+MeshTopology::GetBoundaryVertexFlags()
+{
+  // The boundary is found along with the cell adjacency
+  this->GetCellAdjacency();
+  return m_Boundary;
+}
@@ -0,0 +1,94 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    MeshTopology.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __MeshTopology_h_
+#define __MeshTopology_h_
+
+#include "CotangentWeights.h"
+#include "MeshAdjacency.h"
+#include <vtkType.h>
+
+class vtkPolyData;
+class ThreadPool;
+
+/**
+ * Lazily computed topology of a mesh on the stack: the vertex and cell
+ * adjacency graphs, the list of edges and the boundary vertices, as well as
+ * the cotangent weights of the edges. Each item is computed on first use
+ * and kept until the connectivity of the mesh changes (or for the weights,
+ * until the points move), so that a chain of commands working on the same
+ * mesh pays for it only once. Adding or modifying data arrays does not
+ * invalidate it.
+ */
+class MeshTopology
+{
+public:
+
+  MeshTopology(vtkPolyData *mesh, ThreadPool *pool);
+
+  /** Set the thread pool used to compute the items */
+  void SetThreadPool(ThreadPool *pool) { m_Pool = pool; }
+
+  /** Graph of vertices connected by cell edges */
+  const MeshAdjacency &GetVertexAdjacency();
+
+  /** Graph of cells that share a face (tetras) or an edge (triangles) */
+  const MeshAdjacency &GetCellAdjacency();
+
+  /** Undirected vertex edges (i, j) with i < j */
+  const std::vector<MeshAdjacency::Edge> &GetEdges();
+
+  /** Finite element weights of the edges of the vertex adjacency graph */
+  const CotangentWeights &GetCotangentWeights();
+
+  /** Flag for each vertex on the boundary of the mesh */
+  const std::vector<unsigned char> &GetBoundaryVertexFlags();
+
+protected:
+
+  // Items that can be computed
+  enum Item { VERTEX_ADJACENCY = 1, CELL_ADJACENCY = 2, EDGES = 4, COTANGENT_WEIGHTS = 8 };
+
+  // Throw away everything if the connectivity of the mesh has changed, and
+  // the weights if the points have moved
+  void CheckModified();
+
+  vtkPolyData *m_Mesh;
+  ThreadPool *m_Pool;
+
+  // Connectivity and point time stamps and size of the mesh when items were
+  // computed
+  vtkMTimeType m_ConnectivityMTime, m_PointsMTime;
+  vtkIdType m_NumberOfPoints, m_NumberOfCells;
+
+  // Which items are up to date
+  int m_Valid;
+
+  MeshAdjacency m_VertexAdjacency, m_CellAdjacency;
+  std::vector<MeshAdjacency::Edge> m_Edges;
+  std::vector<unsigned char> m_Boundary;
+  CotangentWeights m_CotangentWeights;
+};
+
+#endif
@@ -0,0 +1,475 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    NativeMeshFile.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "NativeMeshFile.h"
+#include "MappedFile.h"
+#include "Mesh3D.h"
+#include <vtkPolyData.h>
+#include <vtkPoints.h>
+#include <vtkPointData.h>
+#include <vtkCellData.h>
+#include <vtkCellArray.h>
+#include <vtkDataArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkVersion.h>
+#if VTK_MAJOR_VERSION >= 9
+#include <vtkTypeInt64Array.h>
+#endif
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+
+// Arrays can only wrap the mapped file if a custom free function can be
+// given to them, otherwise the sections are copied
+#if VTK_MAJOR_VERSION > 8 || (VTK_MAJOR_VERSION == 8 && VTK_MINOR_VERSION >= 1)
+#define MESH3D_WRAP_MAPPED_ARRAYS
+#endif
+
+namespace native_mesh_file {
+
+// File signature and version
+const char FileMagic[8] = { 'M', '3', 'D', 'M', 'E', 'S', 'H', '1' };
+const uint32_t FileVersion = 1;
+
+// Alignment of the sections in the file
+const uint64_t Alignment = 64;
+
+// What a section holds
+enum SectionKind { POINTS = 1, CELL_OFFSETS, CELL_CONNECTIVITY, POINT_DATA, CELL_DATA, FIELD_DATA };
+
+// Names of the cell arrays, in the order in which VTK numbers the cells
+const char *CellArrayNames[4] = { "verts", "lines", "polys", "strips" };
+
+struct FileHeader
+{
+  char magic[8];
+  uint32_t version, n_sections;
+  uint64_t names_size, reserved;
+};
+
+// An entry of the section table. The tag is the cell array (0 to 3) for the
+// cell sections and the attribute type (scalars, normals, etc. or -1) for
+// point and cell data. The name is a range in the block of names
+struct SectionEntry
+{
+  uint32_t kind;
+  int32_t vtk_type, n_components, tag;
+  uint64_t n_tuples, offset, size, name_offset, name_length, reserved;
+};
+
+bool IsLittleEndian()
+{
+  uint16_t x = 1;
+  return *(const char *) &x == 1;
+}
+
+uint64_t Align(uint64_t x)
+{
+  return (x + Alignment - 1) / Alignment * Alignment;
+}
+
+// A section to be written, with its own storage if the data was converted
+struct OutputSection
+{
+  SectionEntry entry;
+  std::string name;
+  const void *data;
+  std::vector<int64_t> buffer;
+
+  const void *GetData() const { return buffer.size() ? buffer.data() : data; }
+};
+
+void AddSection(std::vector<OutputSection> &sections, SectionKind kind, int tag,
+                const std::string &name, int vtk_type, int n_components,
+                uint64_t n_tuples, uint64_t size, const void *data)
+{
+  OutputSection s;
+  memset(&s.entry, 0, sizeof(SectionEntry));
+  s.entry.kind = kind;
+  s.entry.vtk_type = vtk_type;
+  s.entry.n_components = n_components;
+  s.entry.tag = tag;
+  s.entry.n_tuples = n_tuples;
+  s.entry.size = size;
+  s.name = name;
+  s.data = data;
+  sections.push_back(s);
+}
+
+void AddArraySection(std::vector<OutputSection> &sections, SectionKind kind, int tag, vtkDataArray *arr)
+{
+  AddSection(sections, kind, tag, arr->GetName() ? arr->GetName() : "",
+    arr->GetDataType(), arr->GetNumberOfComponents(), arr->GetNumberOfTuples(),
+    (uint64_t) arr->GetNumberOfValues() * arr->GetDataTypeSize(), arr->GetVoidPointer(0));
+}
+
+// Get the cells of a cell array as offsets and connectivity
+void GetCellLayout(vtkCellArray *ca, std::vector<int64_t> &offsets, std::vector<int64_t> &conn)
+{
+  vtkIdType nc = ca->GetNumberOfCells();
+  offsets.resize(nc + 1);
+  offsets[0] = 0;
+  conn.clear();
+
+#if VTK_MAJOR_VERSION >= 9
+  conn.reserve(ca->GetNumberOfConnectivityIds());
+  vtkIdType npts;
+  const vtkIdType *pts;
+  for(vtkIdType i = 0; i < nc; i++)
+    {
+    ca->GetCellAtId(i, npts, pts);
+    conn.insert(conn.end(), pts, pts + npts);
+    offsets[i+1] = conn.size();
+    }
+#else
+  // Legacy layout, the number of points followed by the point ids
+  conn.reserve(ca->GetNumberOfConnectivityEntries() - nc);
+  const vtkIdType *p = ca->GetPointer();
+  for(vtkIdType i = 0; i < nc; i++)
+    {
+    vtkIdType npts = *p++;
+    conn.insert(conn.end(), p, p + npts);
+    p += npts;
+    offsets[i+1] = conn.size();
+    }
+#endif
+}
+
+// Make an array use the data in a section of the mapped file
+void AttachSection(const std::shared_ptr<MappedFile> &file, const SectionEntry &e, vtkDataArray *arr)
+{
+  arr->SetNumberOfComponents(e.n_components);
+  vtkIdType nv = (vtkIdType) (e.n_tuples * e.n_components);
+  char *data = file->GetData() + e.offset;
+  if(nv == 0)
+    {
+    arr->SetNumberOfTuples(0);
+    return;
+    }
+
+#ifdef MESH3D_WRAP_MAPPED_ARRAYS
+  MappedFile::RetainSection(file, data);
+  arr->SetVoidArray(data, nv, 0, VTK_DATA_ARRAY_USER_DEFINED);
+  arr->SetArrayFreeFunction(&MappedFile::ReleaseSection);
+#else
+  arr->SetNumberOfTuples((vtkIdType) e.n_tuples);
+  memcpy(arr->GetVoidPointer(0), data, e.size);
+#endif
+}
+
+// Wrap a section of the mapped file in a VTK array of its type
+vtkSmartPointer<vtkDataArray> WrapSection(const std::shared_ptr<MappedFile> &file, const SectionEntry &e)
+{
+  vtkSmartPointer<vtkDataArray> arr;
+  arr.TakeReference(vtkDataArray::CreateDataArray(e.vtk_type));
+  AttachSection(file, e, arr);
+  return arr;
+}
+
+// Whether a section of the given size in bytes holds exactly n_tuples tuples
+// of nc values of type_size bytes. This divides rather than multiplies, so
+// that the counts in a corrupt header cannot overflow into a match
+bool MatchesSize(uint64_t size, uint64_t n_tuples, uint64_t nc, uint64_t type_size)
+{
+  if(nc == 0 || type_size == 0 || nc > UINT64_MAX / type_size)
+    return false;
+  uint64_t tuple_size = nc * type_size;
+  return size % tuple_size == 0 && size / tuple_size == n_tuples;
+}
+
+// Check that a section is inside the file and its size matches its type
+void CheckSection(const MappedFile &file, const SectionEntry &e, const std::string &name,
+                  const std::string &fn)
+{
+  if(e.offset % Alignment != 0 || e.offset > file.GetSize() || e.size > file.GetSize() - e.offset)
+    throw MeshException("Section %s of %s is outside of the file", name.c_str(), fn.c_str());
+
+  if(e.kind == CELL_OFFSETS || e.kind == CELL_CONNECTIVITY)
+    {
+    if(e.vtk_type != VTK_TYPE_INT64 || e.n_components != 1 || !MatchesSize(e.size, e.n_tuples, 1, 8)
+       || e.tag < 0 || e.tag > 3)
+      throw MeshException("Cell section %s of %s is not valid", name.c_str(), fn.c_str());
+    return;
+    }
+
+  vtkSmartPointer<vtkDataArray> arr;
+  arr.TakeReference(vtkDataArray::CreateDataArray(e.vtk_type));
+  if(!arr || e.n_components < 1
+     || !MatchesSize(e.size, e.n_tuples, (uint64_t) e.n_components, (uint64_t) arr->GetDataTypeSize()))
+    throw MeshException("Array %s in %s has a type or size that is not supported",
+      name.c_str(), fn.c_str());
+}
+
+// Create a cell array from offsets and connectivity sections, checking that
+// they describe valid cells
+vtkSmartPointer<vtkCellArray> MakeCellArray(const std::shared_ptr<MappedFile> &file,
+                                            const SectionEntry &e_off, const SectionEntry &e_conn,
+                                            vtkIdType n_points, const std::string &fn)
+{
+  const int64_t *offsets = (const int64_t *) (file->GetData() + e_off.offset);
+  const int64_t *conn = (const int64_t *) (file->GetData() + e_conn.offset);
+  vtkIdType nc = (vtkIdType) e_off.n_tuples - 1, n_conn = (vtkIdType) e_conn.n_tuples;
+  bool valid = nc >= 0 && offsets[0] == 0 && offsets[nc] == n_conn;
+  for(vtkIdType i = 0; valid && i < nc; i++)
+    valid = offsets[i] <= offsets[i+1];
+  for(vtkIdType k = 0; valid && k < n_conn; k++)
+    valid = conn[k] >= 0 && conn[k] < n_points;
+  if(!valid)
+    throw MeshException("Cells in %s are not valid", fn.c_str());
+
+  vtkSmartPointer<vtkCellArray> ca = vtkSmartPointer<vtkCellArray>::New();
+#if VTK_MAJOR_VERSION >= 9
+  // The sections are used as they are, which needs the exact array type
+  // that vtkCellArray stores
+  vtkSmartPointer<vtkTypeInt64Array> off_arr = vtkSmartPointer<vtkTypeInt64Array>::New();
+  vtkSmartPointer<vtkTypeInt64Array> conn_arr = vtkSmartPointer<vtkTypeInt64Array>::New();
+  AttachSection(file, e_off, off_arr);
+  AttachSection(file, e_conn, conn_arr);
+  ca->SetData(off_arr, conn_arr);
+#else
+  // Convert to the legacy layout
+  vtkSmartPointer<vtkIdTypeArray> legacy = vtkSmartPointer<vtkIdTypeArray>::New();
+  legacy->SetNumberOfValues(nc + n_conn);
+  vtkIdType *p = legacy->GetPointer(0);
+  for(vtkIdType i = 0; i < nc; i++)
+    {
+    *p++ = (vtkIdType) (offsets[i+1] - offsets[i]);
+    for(int64_t k = offsets[i]; k < offsets[i+1]; k++)
+      *p++ = (vtkIdType) conn[k];
+    }
+  ca->SetCells(nc, legacy);
+#endif
+  return ca;
+}
+
+} // namespace
+
+using namespace native_mesh_file;
+
+vtkSmartPointer<vtkPolyData>
+NativeMeshFile::Read(const std::string &fn)
+{
+  if(!IsLittleEndian())
+    throw MeshException("The .m3d format is only supported on little-endian machines");
+
+  std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+  file->Open(fn);
+
+  // Check the header and find the table and the names
+  const FileHeader *header = (const FileHeader *) file->GetData();
+  if(file->GetSize() < sizeof(FileHeader) || memcmp(header->magic, FileMagic, 8) != 0)
+    throw MeshException("File %s is not a .m3d mesh", fn.c_str());
+  if(header->version != FileVersion)
+    throw MeshException("File %s has unsupported .m3d version %d", fn.c_str(), (int) header->version);
+
+  uint64_t table_end = sizeof(FileHeader) + (uint64_t) header->n_sections * sizeof(SectionEntry);
+  if(table_end > file->GetSize() || header->names_size > file->GetSize() - table_end)
+    throw MeshException("File %s is truncated", fn.c_str());
+
+  const SectionEntry *table = (const SectionEntry *) (file->GetData() + sizeof(FileHeader));
+  const char *names = file->GetData() + table_end;
+
+  // Check all the sections
+  std::vector<std::string> section_names(header->n_sections);
+  for(uint32_t s = 0; s < header->n_sections; s++)
+    {
+    const SectionEntry &e = table[s];
+    if(e.name_offset > header->names_size || e.name_length > header->names_size - e.name_offset)
+      throw MeshException("Section %d of %s has an invalid name", (int) s, fn.c_str());
+    section_names[s] = std::string(names + e.name_offset, e.name_length);
+    CheckSection(*file, e, section_names[s], fn);
+    }
+
+  vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+
+  // The points and cells come first, so that the array sizes can be checked
+  const SectionEntry *cell_sections[4][2] = { { NULL, NULL } };
+  for(uint32_t s = 0; s < header->n_sections; s++)
+    {
+    const SectionEntry &e = table[s];
+    if(e.kind == POINTS)
+      {
+      if(e.n_components != 3 || (e.vtk_type != VTK_FLOAT && e.vtk_type != VTK_DOUBLE))
+        throw MeshException("Points in %s must be float or double triples", fn.c_str());
+      vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+      points->SetData(WrapSection(file, e));
+      mesh->SetPoints(points);
+      }
+    else if(e.kind == CELL_OFFSETS || e.kind == CELL_CONNECTIVITY)
+      {
+      cell_sections[e.tag][e.kind == CELL_OFFSETS ? 0 : 1] = &e;
+      }
+    }
+
+  for(int a = 0; a < 4; a++)
+    {
+    if(!cell_sections[a][0] && !cell_sections[a][1])
+      continue;
+    if(!cell_sections[a][0] || !cell_sections[a][1])
+      throw MeshException("Cell array %s in %s is incomplete", CellArrayNames[a], fn.c_str());
+
+    vtkSmartPointer<vtkCellArray> ca = MakeCellArray(file, *cell_sections[a][0],
+      *cell_sections[a][1], mesh->GetNumberOfPoints(), fn);
+    switch(a)
+      {
+      case 0: mesh->SetVerts(ca); break;
+      case 1: mesh->SetLines(ca); break;
+      case 2: mesh->SetPolys(ca); break;
+      case 3: mesh->SetStrips(ca); break;
+      }
+    }
+
+  // The data arrays, sections of other kinds are skipped
+  for(uint32_t s = 0; s < header->n_sections; s++)
+    {
+    const SectionEntry &e = table[s];
+    vtkFieldData *fd = NULL;
+    vtkIdType n_expected = (vtkIdType) e.n_tuples;
+    if(e.kind == POINT_DATA)
+      {
+      fd = mesh->GetPointData();
+      n_expected = mesh->GetNumberOfPoints();
+      }
+    else if(e.kind == CELL_DATA)
+      {
+      fd = mesh->GetCellData();
+      n_expected = mesh->GetNumberOfCells();
+      }
+    else if(e.kind == FIELD_DATA)
+      {
+      fd = mesh->GetFieldData();
+      }
+    else continue;
+
+    if((vtkIdType) e.n_tuples != n_expected)
+      throw MeshException("Array %s in %s has %ld tuples, expected %ld", section_names[s].c_str(),
+        fn.c_str(), (long) e.n_tuples, (long) n_expected);
+
+    vtkSmartPointer<vtkDataArray> arr = WrapSection(file, e);
+    if(section_names[s].size())
+      arr->SetName(section_names[s].c_str());
+    fd->AddArray(arr);
+
+    vtkDataSetAttributes *dsa = vtkDataSetAttributes::SafeDownCast(fd);
+    if(dsa && e.tag >= 0 && section_names[s].size())
+      dsa->SetActiveAttribute(section_names[s].c_str(), e.tag);
+    }
+
+  return mesh;
+}
+
+void
+NativeMeshFile::Write(vtkPolyData *mesh, const std::string &fn,
+                      std::vector<std::string> *skipped)
+{
+  if(!IsLittleEndian())
+    throw MeshException("The .m3d format is only supported on little-endian machines");
+
+  // Collect the sections, the arrays are written from their own storage
+  std::vector<OutputSection> sections;
+  if(mesh->GetPoints())
+    AddArraySection(sections, POINTS, -1, mesh->GetPoints()->GetData());
+
+  vtkCellArray *cells[] = { mesh->GetVerts(), mesh->GetLines(), mesh->GetPolys(), mesh->GetStrips() };
+  for(int a = 0; a < 4; a++)
+    {
+    if(!cells[a] || cells[a]->GetNumberOfCells() == 0)
+      continue;
+
+    std::vector<int64_t> offsets, conn;
+    GetCellLayout(cells[a], offsets, conn);
+    AddSection(sections, CELL_OFFSETS, a, CellArrayNames[a], VTK_TYPE_INT64, 1,
+      offsets.size(), offsets.size() * 8, NULL);
+    sections.back().buffer.swap(offsets);
+    AddSection(sections, CELL_CONNECTIVITY, a, CellArrayNames[a], VTK_TYPE_INT64, 1,
+      conn.size(), conn.size() * 8, NULL);
+    sections.back().buffer.swap(conn);
+    }
+
+  SectionKind data_kind[] = { POINT_DATA, CELL_DATA, FIELD_DATA };
+  vtkFieldData *data[] = { mesh->GetPointData(), mesh->GetCellData(), mesh->GetFieldData() };
+  for(int k = 0; k < 3; k++)
+    {
+    vtkDataSetAttributes *dsa = vtkDataSetAttributes::SafeDownCast(data[k]);
+    for(int i = 0; i < data[k]->GetNumberOfArrays(); i++)
+      {
+      vtkAbstractArray *aa = data[k]->GetAbstractArray(i);
+      vtkDataArray *arr = vtkDataArray::SafeDownCast(aa);
+      if(!arr || arr->GetDataType() == VTK_BIT)
+        {
+        if(skipped)
+          skipped->push_back(aa && aa->GetName() ? aa->GetName() : "");
+        continue;
+        }
+      AddArraySection(sections, data_kind[k], dsa ? dsa->IsArrayAnAttribute(i) : -1, arr);
+      }
+    }
+
+  // Lay out the names and the sections
+  std::string names;
+  for(size_t s = 0; s < sections.size(); s++)
+    {
+    sections[s].entry.name_offset = names.size();
+    sections[s].entry.name_length = sections[s].name.size();
+    names += sections[s].name;
+    }
+
+  FileHeader header;
+  memset(&header, 0, sizeof(FileHeader));
+  memcpy(header.magic, FileMagic, 8);
+  header.version = FileVersion;
+  header.n_sections = (uint32_t) sections.size();
+  header.names_size = names.size();
+
+  uint64_t pos = Align(sizeof(FileHeader) + sections.size() * sizeof(SectionEntry) + names.size());
+  for(size_t s = 0; s < sections.size(); s++)
+    {
+    sections[s].entry.offset = pos;
+    pos = Align(pos + sections[s].entry.size);
+    }
+
+  // Write everything in order, each section with a single write
+  std::ofstream os(fn.c_str(), std::ios::binary);
+  if(!os)
+    throw MeshException("Unable to open %s for writing", fn.c_str());
+
+  const char zeros[Alignment] = { 0 };
+  os.write((const char *) &header, sizeof(FileHeader));
+  for(size_t s = 0; s < sections.size(); s++)
+    os.write((const char *) &sections[s].entry, sizeof(SectionEntry));
+  os.write(names.data(), names.size());
+
+  uint64_t written = sizeof(FileHeader) + sections.size() * sizeof(SectionEntry) + names.size();
+  for(size_t s = 0; s < sections.size(); s++)
+    {
+    const SectionEntry &e = sections[s].entry;
+    os.write(zeros, e.offset - written);
+    os.write((const char *) sections[s].GetData(), e.size);
+    written = e.offset + e.size;
+    }
+  os.write(zeros, Align(written) - written);
+
+  if(!os)
+    throw MeshException("Error writing mesh to %s", fn.c_str());
+}
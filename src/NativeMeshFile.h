@@ -0,0 +1,59 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    NativeMeshFile.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __NativeMeshFile_h_
+#define __NativeMeshFile_h_
+
+#include <vtkSmartPointer.h>
+#include <string>
+#include <vector>
+
+class vtkPolyData;
+
+/**
+ * The native .m3d mesh format, which stores the points, the cell arrays and
+ * the named point, cell and field data arrays of a vtkPolyData as raw
+ * little-endian sections aligned to 64 bytes. The file starts with a header
+ * and a table giving the type, size and offset of each section, followed
+ * by the array names. Cells are stored as offsets and connectivity, both
+ * 64-bit. Reading maps the file into memory and wraps the sections as VTK
+ * arrays without copying (with VTK 8.1 and later; for the cells, VTK 9),
+ * so only the pages that are used are ever read from disk.
+ */
+class NativeMeshFile
+{
+public:
+
+  /** Read a mesh, throws a MeshException if the file is not valid */
+  static vtkSmartPointer<vtkPolyData> Read(const std::string &fn);
+
+  /**
+   * Write a mesh with large sequential writes. Arrays that are not numeric
+   * can not be stored and are skipped, and their names are added to skipped
+   */
+  static void Write(vtkPolyData *mesh, const std::string &fn,
+                    std::vector<std::string> *skipped = NULL);
+};
+
+#endif
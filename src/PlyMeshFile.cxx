@@ -0,0 +1,778 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    PlyMeshFile.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "PlyMeshFile.h"
+#include "MappedFile.h"
+#include "Mesh3D.h"
+#include <vtkPolyData.h>
+#include <vtkPoints.h>
+#include <vtkPointData.h>
+#include <vtkCellData.h>
+#include <vtkCellArray.h>
+#include <vtkDataArray.h>
+#include <vtkIdList.h>
+#include <vtkIdTypeArray.h>
+#include <vtkVersion.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+
+namespace ply_mesh_file {
+
+// Scalar types of the PLY format, with their newer names, and the matching
+// VTK types
+struct PlyType
+{
+  const char *name, *alias;
+  int vtk_type;
+  int size;
+};
+
+const PlyType PlyTypes[] = {
+  { "char", "int8", VTK_SIGNED_CHAR, 1 },
+  { "uchar", "uint8", VTK_UNSIGNED_CHAR, 1 },
+  { "short", "int16", VTK_SHORT, 2 },
+  { "ushort", "uint16", VTK_UNSIGNED_SHORT, 2 },
+  { "int", "int32", VTK_INT, 4 },
+  { "uint", "uint32", VTK_UNSIGNED_INT, 4 },
+  { "float", "float32", VTK_FLOAT, 4 },
+  { "double", "float64", VTK_DOUBLE, 8 } };
+
+enum PlyTypeIndex { CHAR, UCHAR, SHORT, USHORT, INT, UINT, FLOAT, DOUBLE, NUM_TYPES };
+
+int FindPlyType(const std::string &name)
+{
+  for(int t = 0; t < NUM_TYPES; t++)
+    if(name == PlyTypes[t].name || name == PlyTypes[t].alias)
+      return t;
+  return -1;
+}
+
+// A property of an element, with count_type -1 for scalar properties
+struct Property
+{
+  std::string name;
+  int type, count_type;
+  size_t offset;
+};
+
+struct Element
+{
+  std::string name;
+  vtkIdType count;
+  std::vector<Property> props;
+  size_t record_size;
+  bool has_lists;
+};
+
+// Where the values of a property are stored
+struct Target
+{
+  vtkDataArray *arr;
+  int comp;
+};
+
+bool IsLittleEndian()
+{
+  uint16_t x = 1;
+  return *(const char *) &x == 1;
+}
+
+template <class T>
+double Load(const char *p)
+{
+  T v;
+  memcpy(&v, p, sizeof(T));
+  return (double) v;
+}
+
+// Value of a binary scalar of the given PLY type
+double LoadValue(const char *p, int type, bool swap)
+{
+  char buf[8];
+  if(swap)
+    {
+    std::reverse_copy(p, p + PlyTypes[type].size, buf);
+    p = buf;
+    }
+
+  switch(type)
+    {
+    case CHAR: return Load<int8_t>(p);
+    case UCHAR: return Load<uint8_t>(p);
+    case SHORT: return Load<int16_t>(p);
+    case USHORT: return Load<uint16_t>(p);
+    case INT: return Load<int32_t>(p);
+    case UINT: return Load<uint32_t>(p);
+    case FLOAT: return Load<float>(p);
+    default: return Load<double>(p);
+    }
+}
+
+template <class T>
+void Store(char *p, double v)
+{
+  T x = (T) v;
+  memcpy(p, &x, sizeof(T));
+}
+
+// Store a value as a binary scalar of the given PLY type
+void StoreValue(char *p, int type, double v)
+{
+  switch(type)
+    {
+    case CHAR: Store<int8_t>(p, v); break;
+    case UCHAR: Store<uint8_t>(p, v); break;
+    case SHORT: Store<int16_t>(p, v); break;
+    case USHORT: Store<uint16_t>(p, v); break;
+    case INT: Store<int32_t>(p, v); break;
+    case UINT: Store<uint32_t>(p, v); break;
+    case FLOAT: Store<float>(p, v); break;
+    default: Store<double>(p, v); break;
+    }
+}
+
+// The data of the file, read value by value for ASCII files and for
+// binary elements with list properties
+struct Source
+{
+  const char *p, *end;
+  bool ascii, swap;
+  std::string fn;
+
+  double Read(int type)
+    {
+    if(ascii)
+      {
+      while(p < end && isspace(*p))
+        p++;
+      double v = 0;
+      std::from_chars_result r = std::from_chars(p, end, v);
+      if(r.ec != std::errc())
+        throw MeshException("Error reading values from PLY file %s", fn.c_str());
+      p = r.ptr;
+      return v;
+      }
+
+    if(end - p < PlyTypes[type].size)
+      throw MeshException("PLY file %s is truncated", fn.c_str());
+    double v = LoadValue(p, type, swap);
+    p += PlyTypes[type].size;
+    return v;
+    }
+};
+
+// Copy n values of size N from src to dst with the given strides
+template <int N>
+void CopyStrided(const char *src, size_t src_stride, char *dst, size_t dst_stride,
+                 vtkIdType n, bool swap)
+{
+  for(vtkIdType i = 0; i < n; i++, src += src_stride, dst += dst_stride)
+    {
+    memcpy(dst, src, N);
+    if(swap)
+      std::reverse(dst, dst + N);
+    }
+}
+
+// Copy a property of n binary records into its target. Values are copied
+// as they are when the array has the type of the property
+void CopyProperty(const char *src, vtkIdType n, size_t stride, int type, bool swap,
+                  const Target &t)
+{
+  int size = PlyTypes[type].size;
+  if(t.arr->GetDataType() != PlyTypes[type].vtk_type)
+    {
+    for(vtkIdType i = 0; i < n; i++)
+      t.arr->SetComponent(i, t.comp, LoadValue(src + i * stride, type, swap));
+    return;
+    }
+
+  char *dst = (char *) t.arr->GetVoidPointer(0) + t.comp * size;
+  size_t dst_stride = t.arr->GetNumberOfComponents() * size;
+  switch(size)
+    {
+    case 1: CopyStrided<1>(src, stride, dst, dst_stride, n, swap); break;
+    case 2: CopyStrided<2>(src, stride, dst, dst_stride, n, swap); break;
+    case 4: CopyStrided<4>(src, stride, dst, dst_stride, n, swap); break;
+    default: CopyStrided<8>(src, stride, dst, dst_stride, n, swap); break;
+    }
+}
+
+vtkSmartPointer<vtkDataArray> NewArray(int vtk_type, int nc, vtkIdType n, const std::string &name)
+{
+  vtkSmartPointer<vtkDataArray> arr;
+  arr.TakeReference(vtkDataArray::CreateDataArray(vtk_type));
+  arr->SetNumberOfComponents(nc);
+  arr->SetNumberOfTuples(n);
+  arr->SetName(name.c_str());
+  return arr;
+}
+
+int FindProperty(const Element &e, const std::string &name)
+{
+  for(unsigned int i = 0; i < e.props.size(); i++)
+    if(e.props[i].name == name)
+      return i;
+  return -1;
+}
+
+// Store a group of scalar properties of the same type, such as nx, ny, nz,
+// as the components of one array. Returns false if the element does not
+// have all of them
+bool AddGroup(const Element &e, const std::vector<std::string> &names, const std::string &array,
+              int attribute, vtkDataSetAttributes *attr, std::vector<Target> &targets,
+              std::vector<bool> &used)
+{
+  std::vector<int> idx;
+  for(unsigned int k = 0; k < names.size(); k++)
+    {
+    int i = FindProperty(e, names[k]);
+    if(i < 0 || used[i] || e.props[i].count_type >= 0 || e.props[i].type != e.props[idx.size() ? idx[0] : i].type)
+      return false;
+    idx.push_back(i);
+    }
+
+  vtkSmartPointer<vtkDataArray> arr =
+    NewArray(PlyTypes[e.props[idx[0]].type].vtk_type, (int) idx.size(), e.count, array);
+  for(unsigned int k = 0; k < idx.size(); k++)
+    {
+    targets[idx[k]].arr = arr;
+    targets[idx[k]].comp = k;
+    used[idx[k]] = true;
+    }
+
+  if(attribute >= 0)
+    attr->SetAttribute(arr, attribute);
+  else
+    attr->AddArray(arr);
+  return true;
+}
+
+// Create the arrays for the scalar properties of an element, which must be
+// marked as used if they are stored elsewhere
+void MakeArrays(const Element &e, vtkDataSetAttributes *attr, std::vector<Target> &targets,
+                std::vector<bool> &used)
+{
+  // Components written as name_0, name_1, ...
+  for(unsigned int i = 0; i < e.props.size(); i++)
+    {
+    const std::string &name = e.props[i].name;
+    if(used[i] || name.size() < 3 || name.compare(name.size() - 2, 2, "_0") != 0)
+      continue;
+
+    std::string base = name.substr(0, name.size() - 2);
+    std::vector<std::string> names(1, name);
+    while(i + names.size() < e.props.size()
+          && e.props[i + names.size()].name == base + "_" + std::to_string(names.size()))
+      names.push_back(e.props[i + names.size()].name);
+    if(names.size() > 1)
+      AddGroup(e, names, base, -1, attr, targets, used);
+    }
+
+  // Single properties
+  for(unsigned int i = 0; i < e.props.size(); i++)
+    if(!used[i] && e.props[i].count_type < 0)
+      AddGroup(e, std::vector<std::string>(1, e.props[i].name), e.props[i].name, -1,
+               attr, targets, used);
+}
+
+// Create the points and point arrays for the vertex element
+void MakeVertexArrays(const Element &e, vtkPolyData *mesh, std::vector<Target> &targets,
+                      std::vector<bool> &used, const std::string &fn)
+{
+  int ix = FindProperty(e, "x"), iy = FindProperty(e, "y"), iz = FindProperty(e, "z");
+  if(ix < 0 || iy < 0 || iz < 0 || e.props[ix].count_type >= 0
+     || e.props[iy].count_type >= 0 || e.props[iz].count_type >= 0)
+    throw MeshException("PLY file %s has no vertex coordinates", fn.c_str());
+
+  // Points are kept as float or double
+  int type = e.props[ix].type;
+  if(e.props[iy].type != type || e.props[iz].type != type || (type != FLOAT && type != DOUBLE))
+    type = DOUBLE;
+
+  vtkSmartPointer<vtkDataArray> arr = NewArray(PlyTypes[type].vtk_type, 3, e.count, "Points");
+  vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+  points->SetData(arr);
+  mesh->SetPoints(points);
+  int idx[] = { ix, iy, iz };
+  for(int d = 0; d < 3; d++)
+    {
+    targets[idx[d]].arr = arr;
+    targets[idx[d]].comp = d;
+    used[idx[d]] = true;
+    }
+
+  typedef std::vector<std::string> Names;
+  vtkPointData *pd = mesh->GetPointData();
+  AddGroup(e, Names({ "nx", "ny", "nz" }), "Normals", vtkDataSetAttributes::NORMALS, pd, targets, used);
+  AddGroup(e, Names({ "red", "green", "blue", "alpha" }), "RGBA", vtkDataSetAttributes::SCALARS, pd, targets, used)
+    || AddGroup(e, Names({ "red", "green", "blue" }), "RGB", vtkDataSetAttributes::SCALARS, pd, targets, used);
+  AddGroup(e, Names({ "s", "t" }), "TCoords", vtkDataSetAttributes::TCOORDS, pd, targets, used)
+    || AddGroup(e, Names({ "u", "v" }), "TCoords", vtkDataSetAttributes::TCOORDS, pd, targets, used)
+    || AddGroup(e, Names({ "texture_u", "texture_v" }), "TCoords", vtkDataSetAttributes::TCOORDS, pd, targets, used);
+
+  MakeArrays(e, pd, targets, used);
+}
+
+// Read the records of an element one value at a time. The point ids of the
+// faces are appended to cells in the legacy VTK layout
+void ReadRecords(Source &src, const Element &e, const std::vector<Target> &targets,
+                 int index_list, std::vector<vtkIdType> &cells)
+{
+  for(vtkIdType i = 0; i < e.count; i++)
+    {
+    for(unsigned int j = 0; j < e.props.size(); j++)
+      {
+      const Property &prop = e.props[j];
+      if(prop.count_type < 0)
+        {
+        double v = src.Read(prop.type);
+        if(targets[j].arr)
+          targets[j].arr->SetComponent(i, targets[j].comp, v);
+        continue;
+        }
+
+      double n = src.Read(prop.count_type);
+      if(n < 0)
+        throw MeshException("Negative list size in PLY file %s", src.fn.c_str());
+      if((int) j == index_list)
+        cells.push_back((vtkIdType) n);
+      for(vtkIdType k = 0; k < (vtkIdType) n; k++)
+        {
+        double v = src.Read(prop.type);
+        if((int) j == index_list)
+          cells.push_back((vtkIdType) v);
+        }
+      }
+    }
+}
+
+// Read binary faces whose only property is a list of 32-bit point ids with
+// an 8-bit count, which is how most files store them
+void ReadFaces(Source &src, const Element &e, std::vector<vtkIdType> &cells)
+{
+  bool is_signed = e.props[0].type == INT;
+  for(vtkIdType i = 0; i < e.count; i++)
+    {
+    if(src.p >= src.end)
+      throw MeshException("PLY file %s is truncated", src.fn.c_str());
+    int n = (unsigned char) *src.p++;
+    if(src.end - src.p < 4 * n)
+      throw MeshException("PLY file %s is truncated", src.fn.c_str());
+
+    cells.push_back(n);
+    for(int k = 0; k < n; k++, src.p += 4)
+      {
+      uint32_t v;
+      memcpy(&v, src.p, 4);
+      cells.push_back(is_signed ? (vtkIdType) (int32_t) v : (vtkIdType) v);
+      }
+    }
+}
+
+// The PLY type in which an array is written, or -1 if it cannot be
+int GetPlyTypeForArray(vtkDataArray *arr)
+{
+  for(int t = 0; t < NUM_TYPES; t++)
+    if(arr->GetDataType() == PlyTypes[t].vtk_type)
+      return t;
+
+  int dt = arr->GetDataType();
+  if(dt == VTK_CHAR)
+    return CHAR;
+
+  // Wider integers are written as 32-bit ones if their values fit
+  bool is_unsigned = dt == VTK_UNSIGNED_LONG || dt == VTK_UNSIGNED_LONG_LONG;
+  if(dt != VTK_LONG && dt != VTK_LONG_LONG && dt != VTK_ID_TYPE && !is_unsigned)
+    return -1;
+  for(int c = 0; c < arr->GetNumberOfComponents(); c++)
+    {
+    double *r = arr->GetRange(c);
+    if(arr->GetNumberOfTuples() && (is_unsigned ? r[1] > 4294967295.0 : (r[0] < -2147483648.0 || r[1] > 2147483647.0)))
+      return -1;
+    }
+  return is_unsigned ? UINT : INT;
+}
+
+// A value written to each record of an element. If the array has the type
+// of the column, its values are copied from base with the given stride
+struct Column
+{
+  std::string name;
+  vtkDataArray *arr;
+  int comp, type;
+  const char *base;
+  size_t stride;
+};
+
+Column MakeColumn(const std::string &name, vtkDataArray *arr, int comp, int type)
+{
+  Column col = { name, arr, comp, type, NULL, 0 };
+  if(arr->GetDataType() == PlyTypes[type].vtk_type && arr->GetNumberOfTuples())
+    {
+    col.stride = arr->GetNumberOfComponents() * PlyTypes[type].size;
+    col.base = (const char *) arr->GetVoidPointer(0) + comp * PlyTypes[type].size;
+    }
+  return col;
+}
+
+// Add columns for the arrays in point or cell data. In point data, the
+// active normals, colors and texture coordinates get their usual names
+void AddColumns(vtkDataSetAttributes *attr, bool point_data, std::vector<Column> &columns,
+                std::vector<std::string> *skipped)
+{
+  for(int i = 0; i < attr->GetNumberOfArrays(); i++)
+    {
+    vtkAbstractArray *aa = attr->GetAbstractArray(i);
+    vtkDataArray *arr = vtkDataArray::SafeDownCast(aa);
+    int type = arr ? GetPlyTypeForArray(arr) : -1;
+    if(type < 0)
+      {
+      if(skipped)
+        skipped->push_back(aa->GetName() ? aa->GetName() : "");
+      continue;
+      }
+
+    // PLY names cannot have spaces
+    std::string name = arr->GetName() ? arr->GetName() : "array" + std::to_string(i);
+    std::replace(name.begin(), name.end(), ' ', '_');
+
+    int nc = arr->GetNumberOfComponents();
+    std::vector<std::string> names;
+    if(point_data && arr == attr->GetNormals() && nc == 3)
+      names = { "nx", "ny", "nz" };
+    else if(point_data && arr == attr->GetScalars() && type == UCHAR && nc == 3)
+      names = { "red", "green", "blue" };
+    else if(point_data && arr == attr->GetScalars() && type == UCHAR && nc == 4)
+      names = { "red", "green", "blue", "alpha" };
+    else if(point_data && arr == attr->GetTCoords() && nc == 2)
+      names = { "s", "t" };
+    else if(nc == 1)
+      names = { name };
+    else
+      for(int c = 0; c < nc; c++)
+        names.push_back(name + "_" + std::to_string(c));
+
+    for(int c = 0; c < nc; c++)
+      columns.push_back(MakeColumn(names[c], arr, c, type));
+    }
+}
+
+// Write the values of tuple i of each column to a binary record
+char *StoreColumns(char *p, const std::vector<Column> &columns, vtkIdType i)
+{
+  for(unsigned int c = 0; c < columns.size(); c++)
+    {
+    const Column &col = columns[c];
+    int size = PlyTypes[col.type].size;
+    if(col.base)
+      memcpy(p, col.base + i * col.stride, size);
+    else
+      StoreValue(p, col.type, col.arr->GetComponent(i, col.comp));
+    p += size;
+    }
+  return p;
+}
+
+size_t GetRecordSize(const std::vector<Column> &columns)
+{
+  size_t size = 0;
+  for(unsigned int c = 0; c < columns.size(); c++)
+    size += PlyTypes[columns[c].type].size;
+  return size;
+}
+
+// Buffer for binary output, written to the stream in large blocks
+class OutputBuffer
+{
+public:
+  OutputBuffer(std::ofstream &os) : m_Stream(os), m_Buffer(1 << 22), m_Used(0) {}
+  ~OutputBuffer() { Flush(); }
+
+  char *Reserve(size_t n)
+    {
+    if(m_Used + n > m_Buffer.size())
+      Flush();
+    if(n > m_Buffer.size())
+      m_Buffer.resize(n);
+    return m_Buffer.data() + m_Used;
+    }
+
+  void Commit(char *p) { m_Used = p - m_Buffer.data(); }
+
+  void Flush()
+    {
+    m_Stream.write(m_Buffer.data(), m_Used);
+    m_Used = 0;
+    }
+
+private:
+  std::ofstream &m_Stream;
+  std::vector<char> m_Buffer;
+  size_t m_Used;
+};
+
+} // namespace
+
+using namespace ply_mesh_file;
+
+vtkSmartPointer<vtkPolyData>
+PlyMeshFile::Read(const std::string &fn)
+{
+  MappedFile file;
+  file.Open(fn);
+  const char *data = file.GetData(), *data_end = data + file.GetSize();
+
+  // The header ends with a line that says end_header
+  const char *header_end = NULL;
+  for(const char *p = data; p < data_end && !header_end; )
+    {
+    const char *eol = (const char *) memchr(p, '\n', data_end - p);
+    if(!eol)
+      break;
+    if(strncmp(p, "end_header", 10) == 0)
+      header_end = eol + 1;
+    p = eol + 1;
+    }
+  if(file.GetSize() < 4 || strncmp(data, "ply", 3) != 0 || !header_end)
+    throw MeshException("File %s is not a PLY file", fn.c_str());
+
+  // Parse the header
+  Source src = { header_end, data_end, false, false, fn };
+  std::vector<Element> elements;
+  std::istringstream header(std::string(data, header_end));
+  std::string line;
+  while(std::getline(header, line))
+    {
+    std::istringstream iss(line);
+    std::string key;
+    iss >> key;
+    if(key == "format")
+      {
+      std::string format;
+      iss >> format;
+      if(format == "ascii")
+        src.ascii = true;
+      else if(format == "binary_little_endian")
+        src.swap = !IsLittleEndian();
+      else if(format == "binary_big_endian")
+        src.swap = IsLittleEndian();
+      else
+        throw MeshException("PLY file %s has unknown format %s", fn.c_str(), format.c_str());
+      }
+    else if(key == "element")
+      {
+      Element e;
+      long long count = -1;
+      iss >> e.name >> count;
+      if(count < 0)
+        throw MeshException("Invalid element in PLY file %s: %s", fn.c_str(), line.c_str());
+      e.count = (vtkIdType) count;
+      e.record_size = 0;
+      e.has_lists = false;
+      elements.push_back(e);
+      }
+    else if(key == "property")
+      {
+      std::string type, count_type, name;
+      iss >> type;
+      if(type == "list")
+        iss >> count_type >> type;
+      iss >> name;
+
+      Property prop = { name, FindPlyType(type), count_type.size() ? FindPlyType(count_type) : -1, 0 };
+      if(elements.empty() || name.empty() || prop.type < 0 || (count_type.size() && prop.count_type < 0))
+        throw MeshException("Invalid property in PLY file %s: %s", fn.c_str(), line.c_str());
+
+      Element &e = elements.back();
+      prop.offset = e.record_size;
+      e.record_size += PlyTypes[prop.type].size;
+      e.has_lists |= prop.count_type >= 0;
+      e.props.push_back(prop);
+      }
+    }
+
+  // Read the elements in order, keeping only the vertices and faces
+  vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+  std::vector<vtkIdType> cells;
+  vtkIdType n_faces = 0;
+  for(unsigned int ie = 0; ie < elements.size(); ie++)
+    {
+    const Element &e = elements[ie];
+    Target none = { NULL, 0 };
+    std::vector<Target> targets(e.props.size(), none);
+    std::vector<bool> used(e.props.size(), false);
+    int index_list = -1;
+    if(e.name == "vertex")
+      {
+      MakeVertexArrays(e, mesh, targets, used, fn);
+      }
+    else if(e.name == "face")
+      {
+      index_list = FindProperty(e, "vertex_indices");
+      if(index_list < 0)
+        index_list = FindProperty(e, "vertex_index");
+      if(index_list < 0 || e.props[index_list].count_type < 0)
+        throw MeshException("Faces in PLY file %s have no vertex indices", fn.c_str());
+      MakeArrays(e, mesh->GetCellData(), targets, used);
+      n_faces = e.count;
+      cells.reserve(e.count * 4);
+      }
+
+    if(!src.ascii && !e.has_lists)
+      {
+      // Fixed size records, each property is copied in one pass
+      if((vtkIdType) ((src.end - src.p) / std::max(e.record_size, (size_t) 1)) < e.count)
+        throw MeshException("PLY file %s is truncated", fn.c_str());
+      for(unsigned int j = 0; j < e.props.size(); j++)
+        if(targets[j].arr)
+          CopyProperty(src.p + e.props[j].offset, e.count, e.record_size,
+                       e.props[j].type, src.swap, targets[j]);
+      src.p += e.count * e.record_size;
+      }
+    else if(!src.ascii && !src.swap && e.props.size() == 1 && index_list == 0
+            && e.props[0].count_type == UCHAR && (e.props[0].type == INT || e.props[0].type == UINT))
+      {
+      ReadFaces(src, e, cells);
+      }
+    else
+      {
+      ReadRecords(src, e, targets, index_list, cells);
+      }
+    }
+
+  if(!mesh->GetPoints())
+    throw MeshException("PLY file %s has no vertices", fn.c_str());
+
+  // Check the faces and store them in the legacy layout
+  vtkIdType np = mesh->GetNumberOfPoints();
+  for(size_t k = 0; k < cells.size(); k += cells[k] + 1)
+    for(vtkIdType j = 1; j <= cells[k]; j++)
+      if(cells[k + j] < 0 || cells[k + j] >= np)
+        throw MeshException("Face in PLY file %s refers to vertex %ld, but there are %ld",
+          fn.c_str(), (long) cells[k + j], (long) np);
+
+  if(n_faces)
+    {
+    vtkSmartPointer<vtkIdTypeArray> legacy = vtkSmartPointer<vtkIdTypeArray>::New();
+    legacy->SetNumberOfValues(cells.size());
+    std::copy(cells.begin(), cells.end(), legacy->GetPointer(0));
+    vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+#if VTK_MAJOR_VERSION >= 9
+    polys->ImportLegacyFormat(legacy);
+#else
+    polys->SetCells(n_faces, legacy);
+#endif
+    mesh->SetPolys(polys);
+    }
+
+  return mesh;
+}
+
+void
+PlyMeshFile::Write(vtkPolyData *mesh, const std::string &fn,
+                   std::vector<std::string> *skipped)
+{
+  // Vertex columns, with the points in their own precision
+  std::vector<Column> vcol, fcol;
+  vtkDataArray *pts = mesh->GetPoints() ? mesh->GetPoints()->GetData() : NULL;
+  int pts_type = pts && pts->GetDataType() == VTK_FLOAT ? FLOAT : DOUBLE;
+  const char *xyz[] = { "x", "y", "z" };
+  for(int d = 0; d < 3 && pts; d++)
+    vcol.push_back(MakeColumn(xyz[d], pts, d, pts_type));
+  AddColumns(mesh->GetPointData(), true, vcol, skipped);
+  AddColumns(mesh->GetCellData(), false, fcol, skipped);
+
+  // Faces are the polygons and the triangles of the strips, each with the
+  // id of its cell for the cell data
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  vtkCellArray *polys = mesh->GetPolys(), *strips = mesh->GetStrips();
+  vtkIdType n_faces = polys->GetNumberOfCells(), max_size = 3;
+  for(polys->InitTraversal(); polys->GetNextCell(ids); )
+    max_size = std::max(max_size, ids->GetNumberOfIds());
+  for(strips->InitTraversal(); strips->GetNextCell(ids); )
+    n_faces += std::max(ids->GetNumberOfIds() - 2, (vtkIdType) 0);
+  int count_type = max_size > 255 ? INT : UCHAR;
+
+  // Header
+  std::ostringstream header;
+  header << "ply\n";
+  header << "format " << (IsLittleEndian() ? "binary_little_endian" : "binary_big_endian") << " 1.0\n";
+  header << "comment written by mesh3d\n";
+  header << "element vertex " << (long long) mesh->GetNumberOfPoints() << "\n";
+  for(unsigned int c = 0; c < vcol.size(); c++)
+    header << "property " << PlyTypes[vcol[c].type].name << " " << vcol[c].name << "\n";
+  header << "element face " << (long long) n_faces << "\n";
+  header << "property list " << PlyTypes[count_type].name << " int vertex_indices\n";
+  for(unsigned int c = 0; c < fcol.size(); c++)
+    header << "property " << PlyTypes[fcol[c].type].name << " " << fcol[c].name << "\n";
+  header << "end_header\n";
+
+  std::ofstream os(fn.c_str(), std::ios::binary);
+  if(!os)
+    throw MeshException("Unable to open %s for writing", fn.c_str());
+  os << header.str();
+
+  {
+  OutputBuffer out(os);
+
+  // Vertex records
+  size_t vsize = GetRecordSize(vcol);
+  for(vtkIdType i = 0; i < mesh->GetNumberOfPoints(); i++)
+    out.Commit(StoreColumns(out.Reserve(vsize), vcol, i));
+
+  // Face records
+  size_t fsize = GetRecordSize(fcol);
+  vtkIdType cell_id = mesh->GetVerts()->GetNumberOfCells() + mesh->GetLines()->GetNumberOfCells();
+  auto write_face = [&](vtkIdType n, const vtkIdType *pts, vtkIdType cell)
+    {
+    char *p = out.Reserve(PlyTypes[count_type].size + 4 * n + fsize);
+    StoreValue(p, count_type, (double) n);
+    p += PlyTypes[count_type].size;
+    for(vtkIdType k = 0; k < n; k++, p += 4)
+      Store<int32_t>(p, (double) pts[k]);
+    out.Commit(StoreColumns(p, fcol, cell));
+    };
+
+  for(polys->InitTraversal(); polys->GetNextCell(ids); cell_id++)
+    write_face(ids->GetNumberOfIds(), ids->GetPointer(0), cell_id);
+  for(strips->InitTraversal(); strips->GetNextCell(ids); cell_id++)
+    {
+    for(vtkIdType k = 0; k + 2 < ids->GetNumberOfIds(); k++)
+      {
+      vtkIdType tri[3] = { ids->GetId(k), ids->GetId(k + 1), ids->GetId(k + 2) };
+      if(k % 2)
+        std::swap(tri[0], tri[1]);
+      write_face(3, tri, cell_id);
+      }
+    }
+  }
+
+  if(!os)
+    throw MeshException("Error writing mesh to %s", fn.c_str());
+}
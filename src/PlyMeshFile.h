@@ -0,0 +1,64 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    PlyMeshFile.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __PlyMeshFile_h_
+#define __PlyMeshFile_h_
+
+#include <vtkSmartPointer.h>
+#include <string>
+#include <vector>
+
+class vtkPolyData;
+
+/**
+ * Reading and writing of PLY polygon meshes. Binary files are mapped into
+ * memory, and the properties of elements with fixed size records, such as
+ * the vertices, are copied straight into VTK arrays. ASCII and big-endian
+ * files are also read. Vertex properties other than x, y, z become point
+ * arrays and face properties other than the vertex indices become cell
+ * arrays: nx, ny, nz are the normals, red, green, blue (and alpha) the
+ * color scalars, s, t or u, v the texture coordinates, and name_0, name_1,
+ * ... the components of an array called name. The writer uses the same
+ * mapping in reverse and writes binary files in the byte order of the
+ * machine.
+ */
+class PlyMeshFile
+{
+public:
+
+  /** Read a mesh, throws a MeshException on errors */
+  static vtkSmartPointer<vtkPolyData> Read(const std::string &fn);
+
+  /**
+   * Write the points, polygons and triangle strips of a mesh in binary PLY,
+   * with the point and cell arrays. Vertex and line cells are not written.
+   * Arrays that PLY cannot store, which
+   * includes 64-bit integers outside of the 32-bit range, are not written
+   * and their names are added to skipped if given
+   */
+  static void Write(vtkPolyData *mesh, const std::string &fn,
+                    std::vector<std::string> *skipped = NULL);
+};
+
+#endif
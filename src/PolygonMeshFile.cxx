@@ -0,0 +1,277 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    PolygonMeshFile.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "PolygonMeshFile.h"
+#include "MappedFile.h"
+#include "TextWriter.h"
+#include "Mesh3D.h"
+#include <vtkPolyData.h>
+#include <vtkPoints.h>
+#include <vtkPointData.h>
+#include <vtkCellArray.h>
+#include <vtkDataArray.h>
+#include <vtkIdList.h>
+#include <charconv>
+#include <cstring>
+
+namespace polygon_mesh_file {
+
+// Write the first n components of tuple i, in single precision for float
+// arrays so that the shortest exact form is also the shortest in the file
+void WriteTuple(TextWriter &out, vtkDataArray *arr, vtkIdType i, int n)
+{
+  double x[9];
+  arr->GetTuple(i, x);
+  bool single = arr->GetDataType() == VTK_FLOAT;
+  for(int k = 0; k < n; k++)
+    {
+    out << ' ';
+    if(single)
+      out << (float) x[k];
+    else
+      out << x[k];
+    }
+  out << '\n';
+}
+
+// Call f with the point ids of each triangle of a triangle strip, with
+// every other triangle flipped so that they all have the same orientation
+template <class TFunc>
+void ForEachStripTriangle(vtkIdList *strip, TFunc f)
+{
+  for(vtkIdType k = 0; k + 2 < strip->GetNumberOfIds(); k++)
+    {
+    vtkIdType tri[3] = { strip->GetId(k), strip->GetId(k + 1), strip->GetId(k + 2) };
+    if(k % 2)
+      std::swap(tri[0], tri[1]);
+    f(tri);
+    }
+}
+
+// Write the 1-based point ids of a cell in OBJ format, with the references
+// to texture coordinates and normals, which use the same numbering
+void WriteOBJCell(TextWriter &out, const char *type, vtkIdType npts, const vtkIdType *ids,
+                  bool tcoords, bool normals)
+{
+  out << type;
+  for(vtkIdType k = 0; k < npts; k++)
+    {
+    long long id = ids[k] + 1;
+    out << ' ' << id;
+    if(tcoords && normals)
+      out << '/' << id << '/' << id;
+    else if(tcoords)
+      out << '/' << id;
+    else if(normals)
+      out << "//" << id;
+    }
+  out << '\n';
+}
+
+// Current position in a mapped OFF file
+struct Cursor
+{
+  const char *p, *end;
+};
+
+// Skip whitespace and comments
+void SkipSpace(Cursor &cur)
+{
+  while(cur.p < cur.end)
+    {
+    if(*cur.p == '#')
+      {
+      const char *eol = (const char *) memchr(cur.p, '\n', cur.end - cur.p);
+      cur.p = eol ? eol : cur.end;
+      }
+    else if(isspace(*cur.p))
+      cur.p++;
+    else
+      break;
+    }
+}
+
+// Read a number, throwing an exception with the given context if the file
+// does not have one here
+template <class T>
+T ReadNumber(Cursor &cur, const std::string &fn, const char *what)
+{
+  SkipSpace(cur);
+  T v = 0;
+  std::from_chars_result r = std::from_chars(cur.p, cur.end, v);
+  if(r.ec != std::errc() || (r.ptr < cur.end && !isspace(*r.ptr) && *r.ptr != '#'))
+    throw MeshException("Error reading %s from OFF file %s", what, fn.c_str());
+  cur.p = r.ptr;
+  return v;
+}
+
+} // namespace
+
+using namespace polygon_mesh_file;
+
+void
+PolygonMeshFile::WriteOBJ(vtkPolyData *mesh, const std::string &fn)
+{
+  TextWriter out(fn);
+
+  vtkDataArray *normals = mesh->GetPointData()->GetNormals();
+  vtkDataArray *tcoords = mesh->GetPointData()->GetTCoords();
+  if(normals && normals->GetNumberOfComponents() != 3)
+    normals = NULL;
+  if(tcoords && (tcoords->GetNumberOfComponents() < 2 || tcoords->GetNumberOfComponents() > 3))
+    tcoords = NULL;
+
+  // Points, texture coordinates and normals
+  vtkIdType np = mesh->GetNumberOfPoints();
+  for(vtkIdType i = 0; i < np; i++)
+    {
+    out << 'v';
+    WriteTuple(out, mesh->GetPoints()->GetData(), i, 3);
+    }
+  for(vtkIdType i = 0; tcoords && i < np; i++)
+    {
+    out << "vt";
+    WriteTuple(out, tcoords, i, 2);
+    }
+  for(vtkIdType i = 0; normals && i < np; i++)
+    {
+    out << "vn";
+    WriteTuple(out, normals, i, 3);
+    }
+
+  // Cells, with strips split into triangles
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  vtkCellArray *verts = mesh->GetVerts(), *lines = mesh->GetLines();
+  vtkCellArray *polys = mesh->GetPolys(), *strips = mesh->GetStrips();
+  for(verts->InitTraversal(); verts->GetNextCell(ids); )
+    WriteOBJCell(out, "p", ids->GetNumberOfIds(), ids->GetPointer(0), false, false);
+  for(lines->InitTraversal(); lines->GetNextCell(ids); )
+    WriteOBJCell(out, "l", ids->GetNumberOfIds(), ids->GetPointer(0), false, false);
+  for(polys->InitTraversal(); polys->GetNextCell(ids); )
+    WriteOBJCell(out, "f", ids->GetNumberOfIds(), ids->GetPointer(0), tcoords, normals);
+  for(strips->InitTraversal(); strips->GetNextCell(ids); )
+    {
+    ForEachStripTriangle(ids, [&](const vtkIdType *tri)
+      { WriteOBJCell(out, "f", 3, tri, tcoords, normals); });
+    }
+
+  out.Close();
+}
+
+vtkIdType
+PolygonMeshFile::WriteOFF(vtkPolyData *mesh, const std::string &fn)
+{
+  TextWriter out(fn);
+
+  // Count the faces, with strips split into triangles
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  vtkCellArray *polys = mesh->GetPolys(), *strips = mesh->GetStrips();
+  vtkIdType n_faces = polys->GetNumberOfCells();
+  for(strips->InitTraversal(); strips->GetNextCell(ids); )
+    n_faces += std::max(ids->GetNumberOfIds() - 2, (vtkIdType) 0);
+
+  vtkIdType np = mesh->GetNumberOfPoints();
+  out << "OFF\n" << (long long) np << ' ' << (long long) n_faces << " 0\n";
+  for(vtkIdType i = 0; i < np; i++)
+    WriteTuple(out, mesh->GetPoints()->GetData(), i, 3);
+
+  for(polys->InitTraversal(); polys->GetNextCell(ids); )
+    {
+    out << (long long) ids->GetNumberOfIds();
+    for(vtkIdType k = 0; k < ids->GetNumberOfIds(); k++)
+      out << ' ' << (long long) ids->GetId(k);
+    out << '\n';
+    }
+  for(strips->InitTraversal(); strips->GetNextCell(ids); )
+    {
+    ForEachStripTriangle(ids, [&](const vtkIdType *tri)
+      { out << '3' << ' ' << (long long) tri[0] << ' ' << (long long) tri[1]
+            << ' ' << (long long) tri[2] << '\n'; });
+    }
+
+  out.Close();
+  return mesh->GetVerts()->GetNumberOfCells() + mesh->GetLines()->GetNumberOfCells();
+}
+
+vtkSmartPointer<vtkPolyData>
+PolygonMeshFile::ReadOFF(const std::string &fn)
+{
+  MappedFile file;
+  file.Open(fn);
+  Cursor cur = { file.GetData(), file.GetData() + file.GetSize() };
+
+  // Header, the counts may be on the same line as the keyword
+  SkipSpace(cur);
+  if(cur.end - cur.p < 3 || strncmp(cur.p, "OFF", 3) != 0
+     || (cur.end - cur.p > 3 && !isspace(cur.p[3]) && cur.p[3] != '#'))
+    throw MeshException("File %s is not a plain OFF file", fn.c_str());
+  cur.p += 3;
+
+  vtkIdType np = ReadNumber<long long>(cur, fn, "the number of vertices");
+  vtkIdType nf = ReadNumber<long long>(cur, fn, "the number of faces");
+  ReadNumber<long long>(cur, fn, "the number of edges");
+  if(np < 0 || nf < 0)
+    throw MeshException("Invalid vertex or face count in OFF file %s", fn.c_str());
+
+  vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+  points->SetNumberOfPoints(np);
+  for(vtkIdType i = 0; i < np; i++)
+    {
+    double x[3];
+    for(int d = 0; d < 3; d++)
+      x[d] = ReadNumber<double>(cur, fn, "a vertex");
+    points->SetPoint(i, x);
+
+    // Skip colors or other values after the coordinates
+    const char *eol = (const char *) memchr(cur.p, '\n', cur.end - cur.p);
+    cur.p = eol ? eol : cur.end;
+    }
+
+  vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+  std::vector<vtkIdType> ids;
+  for(vtkIdType j = 0; j < nf; j++)
+    {
+    vtkIdType n = ReadNumber<long long>(cur, fn, "a face");
+    if(n < 0)
+      throw MeshException("Face %ld in OFF file %s has a negative size", (long) j, fn.c_str());
+    ids.resize(n);
+    for(vtkIdType k = 0; k < n; k++)
+      {
+      ids[k] = ReadNumber<long long>(cur, fn, "a face");
+      if(ids[k] < 0 || ids[k] >= np)
+        throw MeshException("Face %ld in OFF file %s refers to vertex %ld, but there are %ld",
+          (long) j, fn.c_str(), (long) ids[k], (long) np);
+      }
+    polys->InsertNextCell(n, ids.data());
+
+    // Skip the face color
+    const char *eol = (const char *) memchr(cur.p, '\n', cur.end - cur.p);
+    cur.p = eol ? eol : cur.end;
+    }
+
+  vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+  mesh->SetPoints(points);
+  mesh->SetPolys(polys);
+  return mesh;
+}
@@ -0,0 +1,58 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    PolygonMeshFile.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __PolygonMeshFile_h_
+#define __PolygonMeshFile_h_
+
+#include <vtkSmartPointer.h>
+#include <string>
+
+class vtkPolyData;
+
+/**
+ * Direct reading and writing of the Wavefront OBJ and Geomview OFF polygon
+ * mesh formats, without going through the VTK exporters, which need a
+ * render window. Triangle strips are written as triangles. OBJ files also
+ * hold the active point normals and texture coordinates, and the vertex
+ * and line cells. Other point and cell arrays cannot be stored in either
+ * format.
+ */
+class PolygonMeshFile
+{
+public:
+
+  /** Write a mesh in OBJ format */
+  static void WriteOBJ(vtkPolyData *mesh, const std::string &fn);
+
+  /**
+   * Write a mesh in OFF format, which only holds polygons. Returns the
+   * number of vertex and line cells, which are not written
+   */
+  static vtkIdType WriteOFF(vtkPolyData *mesh, const std::string &fn);
+
+  /** Read a mesh in OFF format, colors in the file are ignored */
+  static vtkSmartPointer<vtkPolyData> ReadOFF(const std::string &fn);
+};
+
+#endif
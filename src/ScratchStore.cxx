@@ -0,0 +1,203 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    ScratchStore.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "ScratchStore.h"
+#include "Mesh3D.h"
+#include <vtkDataArray.h>
+#include <vtkVersion.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Arrays can only use a scratch file if a custom free function can be
+// given to them, otherwise they are kept in memory
+#if !defined(_WIN32) && (VTK_MAJOR_VERSION > 8 || (VTK_MAJOR_VERSION == 8 && VTK_MINOR_VERSION >= 1))
+#define MESH3D_SCRATCH_ARRAYS
+#endif
+
+namespace scratch_store {
+
+// Size of each scratch mapping, by start address
+std::mutex RegistryMutex;
+std::map<char *, size_t> Registry;
+
+// The scratch mapping that contains [p, p + n), and its size
+bool FindMapping(const char *p, size_t n, char *&start, size_t &size)
+{
+  std::lock_guard<std::mutex> lock(RegistryMutex);
+  std::map<char *, size_t>::iterator it = Registry.upper_bound((char *) p);
+  if(it == Registry.begin())
+    return false;
+  --it;
+  start = it->first;
+  size = it->second;
+  return p >= start && p + n <= start + size;
+}
+
+#ifdef MESH3D_SCRATCH_ARRAYS
+
+// Reserve the disk blocks of a file of the given size up front. A sparse
+// file would only fail when a page is first written through the mapping,
+// which raises SIGBUS instead of an error. Returns an errno value
+int AllocateFile(int fd, size_t size)
+{
+#ifdef __APPLE__
+  fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t) size, 0 };
+  if(fcntl(fd, F_PREALLOCATE, &store) != 0)
+    return errno;
+  return ftruncate(fd, (off_t) size) != 0 ? errno : 0;
+#else
+  return posix_fallocate(fd, 0, (off_t) size);
+#endif
+}
+
+#endif
+
+} // namespace
+
+using namespace scratch_store;
+
+ScratchStore::ScratchStore()
+  : m_MemoryBudget(0)
+{
+}
+
+vtkSmartPointer<vtkDataArray>
+ScratchStore::NewArray(int vtk_type, int nc, vtkIdType nt) const
+{
+  vtkSmartPointer<vtkDataArray> arr;
+  arr.TakeReference(vtkDataArray::CreateDataArray(vtk_type));
+  arr->SetNumberOfComponents(nc);
+
+  size_t size = (size_t) nt * nc * arr->GetDataTypeSize();
+#ifdef MESH3D_SCRATCH_ARRAYS
+  if(!m_Directory.empty() && size > 0)
+    {
+    // The file is unlinked right away, so it is removed when it is unmapped
+    // or the process ends
+    std::string path = m_Directory + "/mesh3d_scratch_XXXXXX";
+    std::vector<char> templ(path.begin(), path.end());
+    templ.push_back(0);
+    int fd = mkstemp(templ.data());
+    if(fd < 0)
+      throw MeshException("Unable to create a scratch file in %s: %s",
+        m_Directory.c_str(), strerror(errno));
+    unlink(templ.data());
+
+    int err = AllocateFile(fd, size);
+    if(err != 0)
+      {
+      close(fd);
+      throw MeshException("Unable to allocate %ld bytes in scratch directory %s: %s",
+        (long) size, m_Directory.c_str(), strerror(err));
+      }
+
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+      throw MeshException("Unable to map a scratch file of %ld bytes", (long) size);
+
+    std::unique_lock<std::mutex> lock(RegistryMutex);
+    Registry[(char *) p] = size;
+    lock.unlock();
+
+    arr->SetVoidArray(p, nt * nc, 0, VTK_DATA_ARRAY_USER_DEFINED);
+    arr->SetArrayFreeFunction(&ScratchStore::FreeArray);
+    return arr;
+    }
+#endif
+
+  arr->SetNumberOfTuples(nt);
+  return arr;
+}
+
+vtkIdType
+ScratchStore::GetChunkSize(vtkIdType n, size_t tuple_size) const
+{
+  if(m_MemoryBudget == 0 || tuple_size == 0)
+    return n > 0 ? n : 1;
+  vtkIdType chunk = (vtkIdType) (m_MemoryBudget / tuple_size);
+  return std::max((vtkIdType) 1, std::min(chunk, n));
+}
+
+void
+ScratchStore::Release(vtkDataArray *arr, vtkIdType begin, vtkIdType end)
+{
+#ifdef MESH3D_SCRATCH_ARRAYS
+  size_t tuple_size = (size_t) arr->GetNumberOfComponents() * arr->GetDataTypeSize();
+  if(end <= begin || tuple_size == 0)
+    return;
+
+  char *p = (char *) arr->GetVoidPointer(0) + begin * tuple_size;
+  size_t n = (end - begin) * tuple_size;
+  char *start;
+  size_t size;
+  if(!FindMapping(p, n, start, size))
+    return;
+
+  // Only the pages that lie entirely in the range can be dropped
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  size_t first = ((p - start) + page - 1) / page * page;
+  size_t last = (p + n == start + size) ? size : (p + n - start) / page * page;
+  if(last <= first)
+    return;
+
+  msync(start + first, last - first, MS_ASYNC);
+  madvise(start + first, last - first, MADV_DONTNEED);
+#endif
+}
+
+void
+ScratchStore::Release(vtkDataArray *arr)
+{
+  ScratchStore::Release(arr, 0, arr->GetNumberOfTuples());
+}
+
+void
+ScratchStore::FreeArray(void *ptr)
+{
+#ifdef MESH3D_SCRATCH_ARRAYS
+  size_t size = 0;
+    {
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+    std::map<char *, size_t>::iterator it = Registry.find((char *) ptr);
+    if(it != Registry.end())
+      {
+      size = it->second;
+      Registry.erase(it);
+      }
+    }
+  if(size)
+    munmap(ptr, size);
+#endif
+}
@@ -0,0 +1,90 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    ScratchStore.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __ScratchStore_h_
+#define __ScratchStore_h_
+
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+#include <string>
+
+class vtkDataArray;
+
+/**
+ * Storage of large arrays outside of memory. With a scratch directory set,
+ * new arrays are kept in shared mappings of unlinked files there, so their
+ * pages are written back to disk under memory pressure instead of taking
+ * up RAM or swap. Commands that stream over arrays process them in chunks
+ * of tuples that fit the memory budget and release each chunk when done,
+ * which bounds the memory in use by the budget rather than by the number
+ * and size of the arrays. Without a scratch directory, arrays are kept in
+ * memory as usual.
+ */
+class ScratchStore
+{
+public:
+
+  ScratchStore();
+
+  /** Set the directory for scratch files, empty to keep arrays in memory */
+  void SetDirectory(const std::string &dir) { m_Directory = dir; }
+  const std::string &GetDirectory() const { return m_Directory; }
+
+  /** Set the memory budget for chunked processing in bytes, zero for none */
+  void SetMemoryBudget(size_t bytes) { m_MemoryBudget = bytes; }
+  size_t GetMemoryBudget() const { return m_MemoryBudget; }
+
+  /**
+   * Create an array of the given VTK type and size, in a scratch file if a
+   * directory is set and the array is not empty. Throws a MeshException if
+   * the file cannot be created
+   */
+  vtkSmartPointer<vtkDataArray> NewArray(int vtk_type, int nc, vtkIdType nt) const;
+
+  /**
+   * Number of tuples to process at a time, out of n tuples of the given
+   * size, so that a chunk fits the memory budget. At least one tuple
+   */
+  vtkIdType GetChunkSize(vtkIdType n, size_t tuple_size) const;
+
+  /**
+   * Drop the tuples [begin, end) of an array from memory after they have
+   * been processed. Modified pages are written to the scratch file first.
+   * Does nothing unless the array is stored in a scratch file
+   */
+  static void Release(vtkDataArray *arr, vtkIdType begin, vtkIdType end);
+
+  /** Drop all of an array from memory */
+  static void Release(vtkDataArray *arr);
+
+  /** Unmap the scratch file of an array, a VTK array free function */
+  static void FreeArray(void *ptr);
+
+protected:
+
+  std::string m_Directory;
+  size_t m_MemoryBudget;
+};
+
+#endif
@@ -0,0 +1,419 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    SpectralBasis.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "SpectralBasis.h"
+#include "GraphLaplacian.h"
+#include "MeshAdjacency.h"
+#include "ThreadPool.h"
+#include "Mesh3D.h"
+#include <vtkMath.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+namespace spectral_basis {
+
+// Shift s in the operator (K + s M)^-1 M, relative to 1 / dt_stable, which
+// is the scale of the spectrum of the operator. It has to be positive
+// because K is singular, and small so that the lowest eigenvalues are well
+// separated after the inversion
+const double Shift = 1e-3;
+
+// Relative accuracy of the Ritz values
+const double Tolerance = 1e-8;
+
+// Number of blocks for parallel reductions
+const int ReductionBlocks = 64;
+
+// File signature. The second version adds the graph hash to the header
+const char FileMagic[8] = { 'M', '3', 'D', 'B', 'A', 'S', 'I', '2' };
+
+// FNV-1a hash of the CSR arrays of a graph, taking each entry as 64 bits so
+// that the hash does not depend on the index types
+unsigned long long HashGraph(const MeshAdjacency &adj)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  auto add = [&hash](unsigned long long value)
+    {
+    for(int b = 0; b < 8; b++, value >>= 8)
+      {
+      hash ^= value & 0xff;
+      hash *= 1099511628211ULL;
+      }
+    };
+
+  vtkIdType n = adj.GetNumberOfNodes();
+  const vtkIdType *offsets = adj.GetOffsets();
+  const MeshAdjacency::IndexType *neighbors = adj.GetNeighbors();
+  for(vtkIdType i = 0; i <= n; i++)
+    add((unsigned long long) offsets[i]);
+  for(vtkIdType j = 0; j < offsets[n]; j++)
+    add((unsigned long long) neighbors[j]);
+  return hash;
+}
+
+// Compute the M-inner products of x with each of the vectors in Q, over a
+// fixed set of blocks so that the result does not depend on the threads
+void MultiDot(ThreadPool *pool, const std::vector<double> &mass,
+              const std::vector<std::vector<double> > &Q,
+              const double *x, std::vector<double> &out)
+{
+  vtkIdType n = mass.size();
+  size_t m = Q.size();
+  std::vector<double> partial(ReductionBlocks * m, 0.0);
+  pool->ParallelFor(ReductionBlocks, [&](vtkIdType b0, vtkIdType b1)
+    {
+    for(vtkIdType b = b0; b < b1; b++)
+      {
+      vtkIdType begin = n * b / ReductionBlocks, end = n * (b + 1) / ReductionBlocks;
+      for(size_t j = 0; j < m; j++)
+        {
+        const double *q = Q[j].data();
+        double sum = 0.0;
+        for(vtkIdType i = begin; i < end; i++)
+          sum += q[i] * mass[i] * x[i];
+        partial[b * m + j] = sum;
+        }
+      }
+    });
+
+  out.assign(m, 0.0);
+  for(int b = 0; b < ReductionBlocks; b++)
+    for(size_t j = 0; j < m; j++)
+      out[j] += partial[b * m + j];
+}
+
+// Orthogonalize x against the M-orthonormal vectors in Q. This is done
+// twice, which is enough to keep the Lanczos vectors orthogonal to working
+// precision. Returns the total coefficient of each vector in Q.
+void Orthogonalize(ThreadPool *pool, const std::vector<double> &mass,
+                   const std::vector<std::vector<double> > &Q,
+                   double *x, std::vector<double> &coeff)
+{
+  coeff.assign(Q.size(), 0.0);
+  std::vector<double> h;
+  for(int pass = 0; pass < 2; pass++)
+    {
+    MultiDot(pool, mass, Q, x, h);
+    pool->ParallelFor(mass.size(), [&](vtkIdType begin, vtkIdType end)
+      {
+      for(size_t j = 0; j < Q.size(); j++)
+        {
+        const double *q = Q[j].data();
+        for(vtkIdType i = begin; i < end; i++)
+          x[i] -= h[j] * q[i];
+        }
+      });
+
+    for(size_t j = 0; j < Q.size(); j++)
+      coeff[j] += h[j];
+    }
+}
+
+// M-norm of a vector
+double MassNorm(ThreadPool *pool, const std::vector<double> &mass, const double *x)
+{
+  vtkIdType n = mass.size();
+  std::vector<double> partial(ReductionBlocks, 0.0);
+  pool->ParallelFor(ReductionBlocks, [&](vtkIdType b0, vtkIdType b1)
+    {
+    for(vtkIdType b = b0; b < b1; b++)
+      {
+      vtkIdType begin = n * b / ReductionBlocks, end = n * (b + 1) / ReductionBlocks;
+      for(vtkIdType i = begin; i < end; i++)
+        partial[b] += mass[i] * x[i] * x[i];
+      }
+    });
+
+  double sum = 0.0;
+  for(int b = 0; b < ReductionBlocks; b++)
+    sum += partial[b];
+  return std::sqrt(sum);
+}
+
+// Eigendecomposition of the tridiagonal Lanczos matrix. Eigenvalues are
+// returned in decreasing order, eigenvectors in the columns of v
+void TridiagonalEigen(const std::vector<double> &alpha, const std::vector<double> &beta,
+                      std::vector<double> &w, std::vector<double> &v)
+{
+  int m = (int) alpha.size();
+  std::vector<double> a_data(m * m, 0.0);
+  std::vector<double *> a(m), vp(m);
+  v.assign(m * m, 0.0);
+  w.assign(m, 0.0);
+  for(int i = 0; i < m; i++)
+    {
+    a[i] = &a_data[i * m];
+    vp[i] = &v[i * m];
+    }
+
+  for(int i = 0; i < m; i++)
+    {
+    a[i][i] = alpha[i];
+    if(i + 1 < m)
+      a[i][i+1] = a[i+1][i] = beta[i];
+    }
+
+  vtkMath::JacobiN(a.data(), m, w.data(), vp.data());
+}
+
+} // namespace
+
+using namespace spectral_basis;
+
+SpectralBasis::SpectralBasis()
+  : m_Nodes(0), m_Edges(0), m_Modes(0), m_Iterations(0), m_GraphHash(0)
+{
+}
+
+bool
+SpectralBasis::IsCompatible(const GraphLaplacian &lap) const
+{
+  const MeshAdjacency &adj = lap.GetAdjacency();
+  if(m_Modes == 0 || m_Nodes != adj.GetNumberOfNodes() || m_Edges != adj.GetNumberOfEdges()
+     || m_GraphHash != HashGraph(adj))
+    return false;
+
+  // The mass tells apart the umbrella and cotangent operators, and meshes
+  // with the same connectivity but different geometry
+  for(vtkIdType i = 0; i < m_Nodes; i++)
+    if(std::fabs(m_Mass[i] - lap.GetMass(i)) > 1e-9 * std::fabs(m_Mass[i]))
+      return false;
+  return true;
+}
+
+void
+SpectralBasis::Compute(const MeshAdjacency &adj, GraphLaplacian &lap, ThreadPool *pool, int k)
+{
+  vtkIdType n = adj.GetNumberOfNodes();
+  k = (int) std::min((vtkIdType) k, n);
+  if(k < 1)
+    throw MeshException("Can not compute a spectral basis with %d modes", k);
+
+  m_Nodes = n;
+  m_Edges = adj.GetNumberOfEdges();
+  m_Modes = k;
+  m_GraphHash = HashGraph(adj);
+
+  // Mass matrix of the Laplacian, which has unit mass for isolated nodes
+  m_Mass.resize(n);
+  for(vtkIdType i = 0; i < n; i++)
+    m_Mass[i] = lap.GetMass(i);
+
+  // Scale the shift to the spectrum of the operator
+  double shift = Shift / lap.GetStableTimeStep();
+
+  // Lanczos vectors and the entries of the tridiagonal matrix
+  std::vector<std::vector<double> > Q;
+  std::vector<double> alpha, beta, coeff, w, v;
+  int max_m = (int) std::min(n, (vtkIdType) (3 * k + 50));
+
+  // Start with a random vector, seeded so that runs are reproducible
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> unif(-1.0, 1.0);
+  std::vector<double> x(n), y(n);
+  for(vtkIdType i = 0; i < n; i++)
+    x[i] = unif(rng);
+
+  double norm = MassNorm(pool, m_Mass, x.data());
+  for(vtkIdType i = 0; i < n; i++)
+    x[i] /= norm;
+  Q.push_back(x);
+
+  bool converged = false;
+  while(!converged)
+    {
+    // Apply the operator, (K + s M)^-1 M q. The implicit solver computes
+    // (M + K / s)^-1 M q, which is the same up to a factor of s
+    const std::vector<double> &q = Q.back();
+    y = q;
+    lap.ImplicitStep(1.0 / shift, 1, q.data(), y.data(), 1e-10, 10000);
+    for(vtkIdType i = 0; i < n; i++)
+      y[i] /= shift;
+
+    // The coefficient of q is the new diagonal entry of the Lanczos matrix
+    Orthogonalize(pool, m_Mass, Q, y.data(), coeff);
+    alpha.push_back(coeff.back());
+    double b = MassNorm(pool, m_Mass, y.data());
+    int m = (int) Q.size();
+
+    // Check if the k largest Ritz values have converged. The residual of a
+    // Ritz pair is b times the last entry of its eigenvector
+    if(m >= k && (m % 5 == 0 || m == max_m || b == 0.0))
+      {
+      TridiagonalEigen(alpha, beta, w, v);
+      converged = true;
+      for(int i = 0; i < k && converged; i++)
+        converged = std::fabs(b * v[(m - 1) * m + i]) <= Tolerance * std::fabs(w[i]);
+      }
+
+    if(converged || m == max_m)
+      break;
+
+    // If the Krylov space is invariant (e.g., the graph is disconnected),
+    // continue with a new random vector orthogonal to the previous ones
+    if(b <= 1e-12 * std::fabs(alpha.back()))
+      {
+      for(vtkIdType i = 0; i < n; i++)
+        y[i] = unif(rng);
+      Orthogonalize(pool, m_Mass, Q, y.data(), coeff);
+      norm = MassNorm(pool, m_Mass, y.data());
+      for(vtkIdType i = 0; i < n; i++)
+        y[i] /= norm;
+      b = 0.0;
+      }
+    else
+      {
+      for(vtkIdType i = 0; i < n; i++)
+        y[i] /= b;
+      }
+
+    beta.push_back(b);
+    Q.push_back(y);
+    }
+
+  // Eigenvalues of the Laplacian, lambda = 1 / theta - s
+  int m = (int) Q.size();
+  m_Iterations = m;
+  if((int) w.size() != m)
+    TridiagonalEigen(alpha, beta, w, v);
+
+  m_Eigenvalues.resize(k);
+  for(int i = 0; i < k; i++)
+    m_Eigenvalues[i] = std::max(0.0, 1.0 / w[i] - shift);
+
+  // Ritz vectors, phi_i = Sum_j q_j v_ji, stored node by node
+  m_Vectors.assign(n * k, 0.0);
+  pool->ParallelFor(n, [&](vtkIdType begin, vtkIdType end)
+    {
+    for(int j = 0; j < m; j++)
+      {
+      const double *q = Q[j].data();
+      for(vtkIdType i = begin; i < end; i++)
+        for(int l = 0; l < k; l++)
+          m_Vectors[i * k + l] += q[i] * v[j * m + l];
+      }
+    });
+}
+
+void
+SpectralBasis::ApplyHeatKernel(double t, int nc, const double *f, double *f_out, ThreadPool *pool) const
+{
+  vtkIdType n = m_Nodes;
+  int k = m_Modes;
+
+  // Project onto the basis, c_l = phi_l' M f
+  std::vector<double> partial(ReductionBlocks * k * nc, 0.0);
+  pool->ParallelFor(ReductionBlocks, [&](vtkIdType b0, vtkIdType b1)
+    {
+    for(vtkIdType b = b0; b < b1; b++)
+      {
+      vtkIdType begin = n * b / ReductionBlocks, end = n * (b + 1) / ReductionBlocks;
+      double *c = &partial[b * k * nc];
+      for(vtkIdType i = begin; i < end; i++)
+        {
+        const double *phi = &m_Vectors[i * k];
+        for(int l = 0; l < k; l++)
+          for(int j = 0; j < nc; j++)
+            c[l * nc + j] += phi[l] * m_Mass[i] * f[i * nc + j];
+        }
+      }
+    });
+
+  // Damp each mode by exp(-t lambda)
+  std::vector<double> c(k * nc, 0.0);
+  for(int b = 0; b < ReductionBlocks; b++)
+    for(int l = 0; l < k * nc; l++)
+      c[l] += partial[b * k * nc + l];
+  for(int l = 0; l < k; l++)
+    for(int j = 0; j < nc; j++)
+      c[l * nc + j] *= std::exp(-t * m_Eigenvalues[l]);
+
+  // Reconstruct
+  pool->ParallelFor(n, [&](vtkIdType begin, vtkIdType end)
+    {
+    for(vtkIdType i = begin; i < end; i++)
+      {
+      const double *phi = &m_Vectors[i * k];
+      for(int j = 0; j < nc; j++)
+        {
+        double sum = 0.0;
+        for(int l = 0; l < k; l++)
+          sum += phi[l] * c[l * nc + j];
+        f_out[i * nc + j] = sum;
+        }
+      }
+    });
+}
+
+void
+SpectralBasis::Save(const std::string &fn) const
+{
+  std::ofstream fs(fn.c_str(), std::ios::binary);
+  if(!fs)
+    throw MeshException("Unable to open %s for writing", fn.c_str());
+
+  long long header[4] = { m_Nodes, m_Edges, m_Modes, (long long) m_GraphHash };
+  fs.write(FileMagic, sizeof(FileMagic));
+  fs.write((const char *) header, sizeof(header));
+  fs.write((const char *) m_Eigenvalues.data(), m_Eigenvalues.size() * sizeof(double));
+  fs.write((const char *) m_Mass.data(), m_Mass.size() * sizeof(double));
+  fs.write((const char *) m_Vectors.data(), m_Vectors.size() * sizeof(double));
+
+  if(!fs)
+    throw MeshException("Error writing spectral basis to %s", fn.c_str());
+}
+
+void
+SpectralBasis::Load(const std::string &fn)
+{
+  std::ifstream fs(fn.c_str(), std::ios::binary);
+  if(!fs)
+    throw MeshException("Unable to open %s for reading", fn.c_str());
+
+  char magic[sizeof(FileMagic)];
+  long long header[4];
+  fs.read(magic, sizeof(magic));
+  fs.read((char *) header, sizeof(header));
+  if(!fs || memcmp(magic, FileMagic, sizeof(FileMagic)) != 0
+     || header[0] < 0 || header[2] < 1 || header[2] > header[0])
+    throw MeshException("File %s is not a spectral basis file", fn.c_str());
+
+  m_Nodes = header[0];
+  m_Edges = header[1];
+  m_Modes = (int) header[2];
+  m_GraphHash = (unsigned long long) header[3];
+  m_Iterations = 0;
+  m_Eigenvalues.resize(m_Modes);
+  m_Mass.resize(m_Nodes);
+  m_Vectors.resize(m_Nodes * m_Modes);
+  fs.read((char *) m_Eigenvalues.data(), m_Eigenvalues.size() * sizeof(double));
+  fs.read((char *) m_Mass.data(), m_Mass.size() * sizeof(double));
+  fs.read((char *) m_Vectors.data(), m_Vectors.size() * sizeof(double));
+
+  if(!fs)
+    throw MeshException("Spectral basis file %s is truncated", fn.c_str());
+}
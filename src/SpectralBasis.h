@@ -0,0 +1,95 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    SpectralBasis.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __SpectralBasis_h_
+#define __SpectralBasis_h_
+
+#include <vtkType.h>
+#include <vector>
+#include <string>
+
+class MeshAdjacency;
+class GraphLaplacian;
+class ThreadPool;
+
+/**
+ * The eigenpairs with the smallest eigenvalues of the graph Laplacian,
+ * i.e., solutions of K phi = lambda M phi in the notation of GraphLaplacian,
+ * normalized so that phi_i' M phi_j = delta_ij. With this basis, the heat
+ * kernel exp(-t L) f is approximated by Sum_i exp(-t lambda_i) phi_i phi_i' M f
+ * for any t at the cost of two passes over the data. The approximation is
+ * good when exp(-t lambda_k) is negligible for the largest lambda_k kept.
+ */
+class SpectralBasis
+{
+public:
+
+  SpectralBasis();
+
+  /**
+   * Compute the k lowest eigenpairs by Lanczos iteration with full
+   * reorthogonalization on the shifted and inverted operator (K + s M)^-1 M.
+   * The inverse is applied with the implicit solver of the Laplacian.
+   */
+  void Compute(const MeshAdjacency &adj, GraphLaplacian &lap, ThreadPool *pool, int k);
+
+  /** Apply the heat kernel for time t to an array with nc components */
+  void ApplyHeatKernel(double t, int nc, const double *f, double *f_out, ThreadPool *pool) const;
+
+  /** Write the basis to a binary file */
+  void Save(const std::string &fn) const;
+
+  /** Read the basis from a binary file written by Save */
+  void Load(const std::string &fn);
+
+  /**
+   * Check if the basis was computed for a given Laplacian. The graph is
+   * compared by a hash of its CSR arrays, and the operator by its mass
+   */
+  bool IsCompatible(const GraphLaplacian &lap) const;
+
+  /** Number of nodes and number of eigenpairs */
+  vtkIdType GetNumberOfNodes() const { return m_Nodes; }
+  int GetNumberOfModes() const { return m_Modes; }
+
+  /** Eigenvalue of mode i */
+  double GetEigenvalue(int i) const { return m_Eigenvalues[i]; }
+
+  /** Number of Lanczos iterations used by the last call to Compute */
+  int GetNumberOfIterations() const { return m_Iterations; }
+
+protected:
+
+  vtkIdType m_Nodes, m_Edges;
+  int m_Modes, m_Iterations;
+
+  // Hash of the offsets and neighbors of the graph
+  unsigned long long m_GraphHash;
+
+  // Eigenvalues, the diagonal mass matrix and the eigenvectors, stored
+  // node by node (the k values for node 0, then for node 1, etc.)
+  std::vector<double> m_Eigenvalues, m_Mass, m_Vectors;
+};
+
+#endif
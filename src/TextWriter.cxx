@@ -0,0 +1,146 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    TextWriter.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "TextWriter.h"
+#include "Mesh3D.h"
+#include <charconv>
+#include <cstring>
+#include <type_traits>
+
+namespace text_writer {
+
+// Size of the output buffer
+const size_t BufferSize = 1 << 20;
+
+// Longest formatted number
+const size_t MaxNumberLength = 64;
+
+} // namespace
+
+using namespace text_writer;
+
+TextWriter::TextWriter(const std::string &fn)
+  : m_FileName(fn), m_Buffer(BufferSize), m_Used(0), m_Precision(0)
+{
+  m_File = fopen(fn.c_str(), "wb");
+  if(!m_File)
+    throw MeshException("Unable to open %s for writing", fn.c_str());
+}
+
+TextWriter::~TextWriter()
+{
+  if(m_File)
+    {
+    fwrite(m_Buffer.data(), 1, m_Used, m_File);
+    fclose(m_File);
+    }
+}
+
+void
+TextWriter::Flush()
+{
+  if(m_Used && fwrite(m_Buffer.data(), 1, m_Used, m_File) != m_Used)
+    throw MeshException("Error writing to %s", m_FileName.c_str());
+  m_Used = 0;
+}
+
+void
+TextWriter::Close()
+{
+  if(!m_File)
+    return;
+
+  Flush();
+  int rc = fclose(m_File);
+  m_File = NULL;
+  if(rc != 0)
+    throw MeshException("Error writing to %s", m_FileName.c_str());
+}
+
+char *
+TextWriter::Reserve(size_t n)
+{
+  if(m_Used + n > m_Buffer.size())
+    {
+    Flush();
+    if(n > m_Buffer.size())
+      m_Buffer.resize(n);
+    }
+  return m_Buffer.data() + m_Used;
+}
+
+template <class T>
+TextWriter &
+TextWriter::WriteNumber(T v)
+{
+  char *p = Reserve(MaxNumberLength), *end = p + MaxNumberLength;
+  std::to_chars_result r;
+  if constexpr(std::is_floating_point<T>::value)
+    {
+    if(m_Precision > 0)
+      r = std::to_chars(p, end, v, std::chars_format::general, m_Precision);
+    else
+      r = std::to_chars(p, end, v);
+    }
+  else
+    {
+    r = std::to_chars(p, end, v);
+    }
+  m_Used += r.ptr - p;
+  return *this;
+}
+
+TextWriter &
+TextWriter::operator << (char c)
+{
+  *Reserve(1) = c;
+  m_Used++;
+  return *this;
+}
+
+TextWriter &
+TextWriter::operator << (const char *s)
+{
+  size_t n = strlen(s);
+  memcpy(Reserve(n), s, n);
+  m_Used += n;
+  return *this;
+}
+
+TextWriter &
+TextWriter::operator << (const std::string &s)
+{
+  memcpy(Reserve(s.size()), s.data(), s.size());
+  m_Used += s.size();
+  return *this;
+}
+
+TextWriter &TextWriter::operator << (int v) { return WriteNumber(v); }
+TextWriter &TextWriter::operator << (unsigned int v) { return WriteNumber(v); }
+TextWriter &TextWriter::operator << (long v) { return WriteNumber(v); }
+TextWriter &TextWriter::operator << (unsigned long v) { return WriteNumber(v); }
+TextWriter &TextWriter::operator << (long long v) { return WriteNumber(v); }
+TextWriter &TextWriter::operator << (unsigned long long v) { return WriteNumber(v); }
+TextWriter &TextWriter::operator << (float v) { return WriteNumber(v); }
+TextWriter &TextWriter::operator << (double v) { return WriteNumber(v); }
@@ -0,0 +1,85 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    TextWriter.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __TextWriter_h_
+#define __TextWriter_h_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Buffered text output to a file, with numbers formatted by std::to_chars,
+ * which is much faster than iostreams for large meshes and arrays. Floating
+ * point values are written in the shortest form that reads back to the same
+ * value, or with a given number of significant digits.
+ */
+class TextWriter
+{
+public:
+
+  /** Open the file for writing, throws a MeshException if this fails */
+  TextWriter(const std::string &fn);
+
+  /** Closes the file if Close was not called, ignoring errors */
+  ~TextWriter();
+
+  /** Write the buffer and close the file, throws a MeshException on errors */
+  void Close();
+
+  /**
+   * Set the number of significant digits of floating point values, or zero
+   * for the shortest exact form, which is the default. More than 17 digits
+   * is never needed to represent a double exactly
+   */
+  void SetPrecision(int digits) { m_Precision = digits > 17 ? 17 : digits; }
+
+  TextWriter &operator << (char c);
+  TextWriter &operator << (const char *s);
+  TextWriter &operator << (const std::string &s);
+  TextWriter &operator << (int v);
+  TextWriter &operator << (unsigned int v);
+  TextWriter &operator << (long v);
+  TextWriter &operator << (unsigned long v);
+  TextWriter &operator << (long long v);
+  TextWriter &operator << (unsigned long long v);
+  TextWriter &operator << (float v);
+  TextWriter &operator << (double v);
+
+protected:
+
+  // Make room for n characters in the buffer
+  char *Reserve(size_t n);
+  void Flush();
+
+  template <class T> TextWriter &WriteNumber(T v);
+
+  std::string m_FileName;
+  FILE *m_File;
+  std::vector<char> m_Buffer;
+  size_t m_Used;
+  int m_Precision;
+};
+
+#endif
@@ -0,0 +1,166 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    ThreadPool.cxx
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int n_threads)
+  : m_Body(NULL), m_Size(0), m_Generation(0), m_Pending(0), m_Quit(false)
+{
+  this->StartWorkers(n_threads - 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+  this->StopWorkers();
+}
+
+void
+ThreadPool::SetNumberOfThreads(int n_threads)
+{
+  if(n_threads < 1)
+    n_threads = 1;
+
+  if(n_threads != this->GetNumberOfThreads())
+    {
+    this->StopWorkers();
+    this->StartWorkers(n_threads - 1);
+    }
+}
+
+void
+ThreadPool::StartWorkers(int n_workers)
+{
+  m_Quit = false;
+  for(int i = 0; i < n_workers; i++)
+    m_Workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i + 1));
+}
+
+void
+ThreadPool::StopWorkers()
+{
+    {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Quit = true;
+    }
+  m_WorkReady.notify_all();
+
+  for(size_t i = 0; i < m_Workers.size(); i++)
+    m_Workers[i].join();
+  m_Workers.clear();
+
+  // New workers start out having seen generation zero, so that they wait
+  // for the next loop instead of running the last one again
+  m_Generation = 0;
+}
+
+void
+ThreadPool::WorkerLoop(int id)
+{
+  unsigned long seen = 0;
+  while(true)
+    {
+    const RangeFunction *body;
+    vtkIdType n;
+    int n_threads;
+
+    // Wait for the next loop or for the signal to quit
+      {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_WorkReady.wait(lock, [&] { return m_Quit || m_Generation != seen; });
+      if(m_Quit)
+        return;
+      seen = m_Generation;
+      body = m_Body;
+      n = m_Size;
+      n_threads = (int) m_Workers.size() + 1;
+      }
+
+    // Process this thread's block of the range
+    vtkIdType begin = n * id / n_threads, end = n * (id + 1) / n_threads;
+    std::exception_ptr error;
+    try
+      {
+      if(begin < end)
+        (*body)(begin, end);
+      }
+    catch(...)
+      {
+      error = std::current_exception();
+      }
+
+      {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      if(error && !m_Error)
+        m_Error = error;
+      if(--m_Pending == 0)
+        m_WorkDone.notify_one();
+      }
+    }
+}
+
+void
+ThreadPool::ParallelFor(vtkIdType n, const RangeFunction &body)
+{
+  // Nothing to gain from the workers for tiny ranges
+  int n_threads = this->GetNumberOfThreads();
+  if(n_threads == 1 || n < n_threads)
+    {
+    if(n > 0)
+      body(0, n);
+    return;
+    }
+
+  // Hand the loop to the workers
+    {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Body = &body;
+    m_Size = n;
+    m_Pending = n_threads - 1;
+    m_Error = std::exception_ptr();
+    m_Generation++;
+    }
+  m_WorkReady.notify_all();
+
+  // Process the first block in this thread
+  std::exception_ptr error;
+  try
+    {
+    body(0, n / n_threads);
+    }
+  catch(...)
+    {
+    error = std::current_exception();
+    }
+
+  // Wait for the workers
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  m_WorkDone.wait(lock, [&] { return m_Pending == 0; });
+  if(!error)
+    error = m_Error;
+  m_Body = NULL;
+  lock.unlock();
+
+  if(error)
+    std::rethrow_exception(error);
+}
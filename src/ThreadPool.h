@@ -0,0 +1,82 @@
+/*=========================================================================
+
+  Program:   Mesh3D: Command-line tool for 3D mesh manipulation
+  Module:    ThreadPool.h
+  Language:  C++
+  Website:   itksnap.org/mesh3d
+  Copyright (c) 2017 Paul A. Yushkevich
+  
+  This file is part of Mesh3D, a command-line tool for 3D mesh manipulation
+
+  Mesh3D is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+=========================================================================*/
+#ifndef __ThreadPool_h_
+#define __ThreadPool_h_
+
+#include <vtkType.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+/**
+ * A simple pool of worker threads for data-parallel loops. The range of a
+ * loop is split into one contiguous block per thread, with the calling
+ * thread processing the first block. The workers persist between loops, so
+ * short loops (e.g. one diffusion time step) do not pay for thread creation.
+ * A pool runs one loop at a time and must not be used from inside a loop body.
+ */
+class ThreadPool
+{
+public:
+
+  // A loop body, called with a range [begin, end) of loop indices
+  typedef std::function<void(vtkIdType, vtkIdType)> RangeFunction;
+
+  ThreadPool(int n_threads = 1);
+  ~ThreadPool();
+
+  /** Set the number of threads, including the calling thread */
+  void SetNumberOfThreads(int n_threads);
+  int GetNumberOfThreads() const { return (int) m_Workers.size() + 1; }
+
+  /**
+   * Run body over the range [0, n) and wait for all threads to finish. An
+   * exception thrown by any of the threads is rethrown in the caller.
+   */
+  void ParallelFor(vtkIdType n, const RangeFunction &body);
+
+protected:
+
+  void StartWorkers(int n_workers);
+  void StopWorkers();
+  void WorkerLoop(int id);
+
+  std::vector<std::thread> m_Workers;
+  std::mutex m_Mutex;
+  std::condition_variable m_WorkReady, m_WorkDone;
+
+  // Current loop, identified by a generation counter
+  const RangeFunction *m_Body;
+  vtkIdType m_Size;
+  unsigned long m_Generation;
+  int m_Pending;
+  bool m_Quit;
+  std::exception_ptr m_Error;
+};
+
+#endif